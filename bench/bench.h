@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace pm {
+
+// performs given number of operations
+typedef std::function<void(uint64_t n_ops)> bench_body_t;
+
+// runs body in n_threads threads at once, growing number of operations
+// until run takes long enough, and prints time per operation
+void run_bench(const std::string& name, const bench_body_t& body,
+               int n_threads = 1);
+
+struct bench_registrar_t {
+    bench_registrar_t(const char* name, void (*bench)());
+};
+
+#define PM_BENCH(name)                                                    \
+    static void name();                                                   \
+    static ::pm::bench_registrar_t name##_registrar(#name, name);         \
+    static void name()
+
+// keeps compiler from throwing away computation of value
+template <class value_t>
+inline void do_not_optimize(const value_t& value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+}  // namespace pm
@@ -0,0 +1,38 @@
+#include "bench.h"
+
+#include <pm/hyperloglog.h>
+#include <pm/metrics.h>
+#include <pm/tree.h>
+
+using namespace pm;
+
+PM_BENCH(cardinality) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+    cardinality_t users = registry.cardinality("users");
+
+    for (int n_threads : {1, 4}) {
+        run_bench("cardinality_t.add", [users](uint64_t n) mutable {
+            for (uint64_t i = 0; i < n; ++i) users.add(i);
+        }, n_threads);
+    }
+
+    hyperloglog_t a, b;
+    for (int i = 0; i < 100000; ++i) {
+        a.add(i);
+        b.add(i + 50000);
+    }
+
+    run_bench("hyperloglog_t.merge", [&a, &b](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            a.merge(b);
+            do_not_optimize(a);
+        }
+    });
+
+    run_bench("hyperloglog_t.estimate", [&a](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            double estimate = a.estimate();
+            do_not_optimize(estimate);
+        }
+    });
+}
@@ -0,0 +1,67 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include <pm/graphite.h>
+#include <pm/metrics.h>
+#include <pm/tree.h>
+
+using namespace pm;
+
+// Short-lived connections each register a counter and a meter under
+// conns.<id>, at most N_LIVE of them are alive at once. Reports latency of
+// registration and size of the tree, which should stay proportional to
+// N_LIVE.
+
+static const int N_LIVE = 1000;
+static const int N_ROUNDS = 10;
+static const int CONNS_PER_ROUND = 100000;
+
+struct connection_t {
+    counter_t bytes;
+    meter_t requests;
+};
+
+PM_BENCH(churn) {
+    auto root = std::make_shared<tree_branch_t>();
+    registry_t conns = registry_t(root).subtree("conns");
+
+    std::vector<connection_t> live(N_LIVE);
+    int next_id = 0;
+
+    printf("%6s %12s %12s %12s %12s\n", "round", "reg ns/op", "max reg us",
+           "print ms", "tree nodes");
+
+    for (int round = 0; round < N_ROUNDS; ++round) {
+        double max_latency = 0;
+        auto round_start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < CONNS_PER_ROUND; ++i, ++next_id) {
+            auto start = std::chrono::steady_clock::now();
+
+            registry_t conn = conns.subtree(std::to_string(next_id));
+            connection_t& c = live[next_id % N_LIVE];
+            c.bytes = conn.counter("bytes");
+            c.requests = conn.meter("requests");
+
+            max_latency = std::max(max_latency, std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+
+        double elapsed = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - round_start).count();
+
+        auto print_start = std::chrono::steady_clock::now();
+        graphite_printer_t printer("bench", 0);
+        conns.print(&printer);
+        double print_time = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - print_start).count();
+
+        printf("%6d %12.2f %12.2f %12.2f %12zu\n", round,
+               elapsed * 1e9 / CONNS_PER_ROUND, max_latency * 1e6,
+               print_time * 1e3, root->size());
+        fflush(stdout);
+    }
+}
@@ -0,0 +1,145 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+#include <pm/counter.h>
+
+using namespace pm;
+
+// Feeds synthetic distributions into histogram engines and compares
+// reported quantiles with exact ones computed from the same samples.
+
+static const int N_SAMPLES = 200000;
+
+// samples are spread over ten minutes and engines decay with time
+// constant DECAY_TIME. Exact quantiles weight every sample the same way,
+// exp(-age / DECAY_TIME), so the error is bucketing error only.
+static const auto DURATION = std::chrono::minutes(10);
+static const auto DECAY_TIME = std::chrono::minutes(5);
+
+static const std::vector<double> QUANTILES = { .5, .9, .99, .999 };
+
+struct distribution_t {
+    const char* name;
+    std::function<double(std::mt19937_64&, double progress)> sample;
+};
+
+static std::vector<distribution_t> distributions() {
+    return {
+        {"uniform(0, 1000)", [](std::mt19937_64& rng, double) {
+             return std::uniform_real_distribution<double>(0, 1000)(rng);
+         }},
+        {"lognormal(3, 1)", [](std::mt19937_64& rng, double) {
+             return std::lognormal_distribution<double>(3, 1)(rng);
+         }},
+        {"bimodal(50, 500)", [](std::mt19937_64& rng, double) {
+             bool slow = std::bernoulli_distribution(0.2)(rng);
+             return slow ? std::normal_distribution<double>(500, 50)(rng)
+                         : std::normal_distribution<double>(50, 5)(rng);
+         }},
+        {"pareto(1, 1.5)", [](std::mt19937_64& rng, double) {
+             double u = std::uniform_real_distribution<double>(0, 1)(rng);
+             return 1.0 / std::pow(1 - u, 1 / 1.5);
+         }},
+        {"shift(100 -> 300)", [](std::mt19937_64& rng, double progress) {
+             double mean = progress < 0.5 ? 100 : 300;
+             return std::normal_distribution<double>(mean, mean / 10)(rng);
+         }},
+    };
+}
+
+struct engine_t {
+    const char* name;
+    double min, max;
+    int n_buckets;
+};
+
+template <class histogram_t>
+static void bench_engine(const char* name, histogram_t* histogram,
+                         const distribution_t& dist) {
+    std::mt19937_64 rng(42);
+
+    auto start = time_point_t(std::chrono::system_clock::now());
+    std::vector<time_point_t> times(N_SAMPLES);
+    std::vector<double> values(N_SAMPLES);
+    for (int i = 0; i < N_SAMPLES; ++i) {
+        double progress = double(i) / N_SAMPLES;
+        times[i] = start + DURATION * progress;
+        values[i] = dist.sample(rng, progress);
+    }
+    auto end = times.back();
+
+    auto update_start = std::chrono::steady_clock::now();
+    for (int i = 0; i < N_SAMPLES; ++i) {
+        histogram->update(times[i], values[i]);
+    }
+    double update_time = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - update_start).count();
+
+    std::vector<double> estimated;
+    histogram->get_quantiles(end, QUANTILES, &estimated);
+
+    // (value, weight) sorted by value
+    std::vector<std::pair<double, double>> weighted(N_SAMPLES);
+    double total = 0;
+    for (int i = 0; i < N_SAMPLES; ++i) {
+        double weight = std::exp(-(end - times[i]) / duration_t(DECAY_TIME));
+        weighted[i] = std::make_pair(values[i], weight);
+        total += weight;
+    }
+    std::sort(weighted.begin(), weighted.end());
+
+    printf("%-24s %-18s", name, dist.name);
+    double sum = 0;
+    size_t i = 0;
+    for (size_t q = 0; q < QUANTILES.size(); ++q) {
+        while (i + 1 < weighted.size() && sum + weighted[i].second < QUANTILES[q] * total) {
+            sum += weighted[i++].second;
+        }
+        double exact = weighted[i].first;
+        double error = std::fabs(estimated[q] - exact) / std::fabs(exact);
+        printf(" %9.2f%%", error * 100);
+    }
+
+    uint64_t clamped = histogram->underflow() + histogram->overflow();
+    printf(" %9.2f%% %10.2f", 100. * clamped / N_SAMPLES,
+           N_SAMPLES / update_time / 1e6);
+}
+
+PM_BENCH(histogram_accuracy) {
+    std::vector<engine_t> engines = {
+        {"linear(0, 1000, 100)", 0, 1000, 100},
+        {"linear(0, 1000, 1000)", 0, 1000, 1000},
+        {"linear(0, 1000, 10000)", 0, 1000, 10000},
+        {"linear(0, 10000, 1000)", 0, 10000, 1000},
+    };
+
+    printf("%-24s %-18s %10s %10s %10s %10s %10s %10s %10s\n", "engine",
+           "distribution", "err q50", "err q90", "err q99", "err q999",
+           "clamped", "Mupd/s", "bytes");
+
+    for (const auto& engine : engines) {
+        for (const auto& dist : distributions()) {
+            histogram_counter_t histogram(
+                DECAY_TIME, linear_mapping_t(engine.min, engine.max, engine.n_buckets));
+            bench_engine(engine.name, &histogram, dist);
+
+            size_t memory = sizeof(histogram_counter_t) +
+                            engine.n_buckets * sizeof(decaying_counter_t);
+            printf(" %10zu\n", memory);
+            fflush(stdout);
+        }
+    }
+
+    for (const auto& dist : distributions()) {
+        auto_histogram_counter_t histogram(DECAY_TIME);
+        bench_engine("auto", &histogram, dist);
+
+        printf(" %10zu\n", histogram.memory_usage());
+        fflush(stdout);
+    }
+}
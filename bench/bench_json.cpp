@@ -0,0 +1,47 @@
+#include "bench.h"
+
+#include <memory>
+#include <vector>
+
+#include <pm/json.h>
+#include <pm/metrics.h>
+#include <pm/tree.h>
+
+using namespace pm;
+
+// one op is a full print of 100k counters, 100 subtrees of 1000 leaves
+PM_BENCH(json) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+
+    std::vector<counter_t> counters;
+    for (int i = 0; i < 100; ++i) {
+        registry_t subtree = registry.subtree("subtree_" + std::to_string(i));
+        for (int j = 0; j < 1000; ++j) {
+            counters.push_back(subtree.counter("counter_" + std::to_string(j)));
+            counters.back().set(i * 1000 + j);
+        }
+    }
+
+    json_printer_t printer;
+    run_bench("json_printer_t 100k counters", [&registry, &printer](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            printer.clear();
+            registry.print(&printer);
+        }
+    });
+
+    std::vector<histogram_t> histograms;
+    for (int i = 0; i < 1000; ++i) {
+        histograms.push_back(registry.subtree("histograms").histogram(
+            "histogram_" + std::to_string(i), 0, 1000));
+        histograms.back().update(i);
+    }
+
+    run_bench("json_printer_t 100k counters + 1k histograms",
+              [&registry, &printer](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            printer.clear();
+            registry.print(&printer);
+        }
+    });
+}
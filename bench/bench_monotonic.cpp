@@ -0,0 +1,33 @@
+#include "bench.h"
+
+#include <memory>
+
+#include <pm/metrics.h>
+#include <pm/tree.h>
+
+using namespace pm;
+
+PM_BENCH(monotonic) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+
+    monotonic_counter_t monotonic = registry.monotonic_counter("monotonic");
+    counter_t counter = registry.counter("counter");
+    meter_t meter = registry.meter("meter");
+
+    for (int n_threads : {1, 4}) {
+        run_bench("monotonic_counter_t.inc", [monotonic](uint64_t n) mutable {
+            for (uint64_t i = 0; i < n; ++i) monotonic.inc();
+        }, n_threads);
+
+        run_bench("counter_t.inc", [counter](uint64_t n) mutable {
+            for (uint64_t i = 0; i < n; ++i) counter.inc();
+        }, n_threads);
+
+        run_bench("counter_t.inc + meter_t.mark", [counter, meter](uint64_t n) mutable {
+            for (uint64_t i = 0; i < n; ++i) {
+                counter.inc();
+                meter.mark();
+            }
+        }, n_threads);
+    }
+}
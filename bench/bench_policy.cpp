@@ -0,0 +1,56 @@
+#include "bench.h"
+
+#include <pm/policy.h>
+
+using namespace pm;
+
+template <class policy_t>
+static void bench_policy(const std::string& policy_name) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+
+    auto counter = registry.counter<policy_t>("counter");
+    auto meter = registry.meter<policy_t>("meter");
+    auto hist = registry.histogram<policy_t>("hist", 0, 1000);
+
+    for (int n_threads : {1, 4}) {
+        run_bench(policy_name + " counter.inc", [counter](uint64_t n) mutable {
+            for (uint64_t i = 0; i < n; ++i) counter.inc();
+        }, n_threads);
+
+        run_bench(policy_name + " meter.mark", [meter](uint64_t n) mutable {
+            for (uint64_t i = 0; i < n; ++i) meter.mark();
+        }, n_threads);
+
+        run_bench(policy_name + " histogram.update", [hist](uint64_t n) mutable {
+            for (uint64_t i = 0; i < n; ++i) hist.update(i % 1000);
+        }, n_threads);
+    }
+}
+
+PM_BENCH(policy_counters) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+
+    counter_t counter = registry.counter("counter");
+    meter_t meter = registry.meter("meter");
+    histogram_t hist = registry.histogram("hist", 0, 1000);
+
+    for (int n_threads : {1, 4}) {
+        run_bench("counter_t.inc", [counter](uint64_t n) mutable {
+            for (uint64_t i = 0; i < n; ++i) counter.inc();
+        }, n_threads);
+
+        run_bench("meter_t.mark", [meter](uint64_t n) mutable {
+            for (uint64_t i = 0; i < n; ++i) meter.mark();
+        }, n_threads);
+
+        run_bench("histogram_t.update", [hist](uint64_t n) mutable {
+            for (uint64_t i = 0; i < n; ++i) hist.update(i % 1000);
+        }, n_threads);
+    }
+
+    bench_policy<relaxed_policy_t>("relaxed_policy_t");
+    bench_policy<striped_policy_t>("striped_policy_t");
+    bench_policy<thread_local_policy_t>("thread_local_policy_t");
+    bench_policy<plain_policy_t>("plain_policy_t");
+    bench_policy<noop_policy_t>("noop_policy_t");
+}
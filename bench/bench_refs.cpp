@@ -0,0 +1,54 @@
+#include "bench.h"
+
+#include <atomic>
+#include <memory>
+
+#include <pm/metrics.h>
+#include <pm/tree.h>
+
+using namespace pm;
+
+// per-request object taking its metrics by value, as in the README
+template <class counter_type_t>
+struct request_t {
+    explicit request_t(counter_type_t requests) : requests(requests) {}
+
+    void handle() { requests.inc(); }
+
+    counter_type_t requests;
+};
+
+template <class counter_type_t>
+static void bench_copies(const std::string& name, counter_type_t counter) {
+    for (int n_threads : {1, 4}) {
+        run_bench(name + " copy", [counter](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                request_t<counter_type_t> request(counter);
+                do_not_optimize(request);
+            }
+        }, n_threads);
+
+        run_bench(name + " copy and inc", [counter](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                request_t<counter_type_t> request(counter);
+                request.handle();
+            }
+        }, n_threads);
+    }
+}
+
+// plain pointer to an atomic as the baseline for refs
+struct raw_counter_t {
+    void inc() { value->fetch_add(1); }
+
+    std::atomic<int64_t>* value;
+};
+
+PM_BENCH(refs) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+
+    std::atomic<int64_t> value(0);
+    bench_copies("raw pointer", raw_counter_t{&value});
+    bench_copies("counter_ref_t", registry.counter_ref("ref"));
+    bench_copies("counter_t", registry.counter("shared"));
+}
@@ -0,0 +1,28 @@
+#include "bench.h"
+
+#include <pm/statsd.h>
+#include <pm/tree.h>
+
+using namespace pm;
+
+// one operation is one line of a packet
+PM_BENCH(statsd) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+    statsd_server_t server(registry);
+
+    std::string packet;
+    int n_lines = 0;
+    for (int i = 0; i < 8; ++i, n_lines += 4) {
+        std::string service = "service" + std::to_string(i);
+        packet += service + ".requests:1|c\n";
+        packet += service + ".queue_size:" + std::to_string(i * 10) + "|g\n";
+        packet += service + ".latency:12.5|ms|@0.1\n";
+        packet += service + ".events:1|m\n";
+    }
+
+    run_bench("statsd_server_t.process", [&server, &packet, n_lines](uint64_t n) {
+        for (uint64_t i = 0; i < n; i += n_lines) {
+            server.process(packet.data(), packet.size());
+        }
+    });
+}
@@ -0,0 +1,29 @@
+#include "bench.h"
+
+#include <random>
+
+#include <pm/metrics.h>
+#include <pm/tree.h>
+
+using namespace pm;
+
+PM_BENCH(top_k) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+    top_k_t top = registry.top_k("top", 10);
+
+    // a few heavy keys over long tail of rare ones
+    std::vector<std::string> keys;
+    std::default_random_engine generator;
+    std::geometric_distribution<int> distribution(0.01);
+    for (int i = 0; i < 1 << 16; ++i) {
+        keys.push_back("tenant" + std::to_string(distribution(generator)));
+    }
+
+    for (int n_threads : {1, 4}) {
+        run_bench("top_k_t.mark", [top, &keys](uint64_t n) mutable {
+            for (uint64_t i = 0; i < n; ++i) {
+                top.mark(keys[i & (keys.size() - 1)]);
+            }
+        }, n_threads);
+    }
+}
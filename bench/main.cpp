@@ -0,0 +1,66 @@
+#include "bench.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace pm {
+
+static const double MIN_RUN_TIME = 0.2;
+static const uint64_t MAX_OPS = uint64_t(1) << 32;
+
+static std::vector<std::pair<const char*, void (*)()>>& benches() {
+    static std::vector<std::pair<const char*, void (*)()>> benches;
+    return benches;
+}
+
+bench_registrar_t::bench_registrar_t(const char* name, void (*bench)()) {
+    benches().emplace_back(name, bench);
+}
+
+static double run_once(const bench_body_t& body, uint64_t n_ops,
+                       int n_threads) {
+    auto start = std::chrono::steady_clock::now();
+
+    if (n_threads == 1) {
+        body(n_ops);
+    } else {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < n_threads; ++i) {
+            threads.emplace_back([&body, n_ops] { body(n_ops); });
+        }
+        for (auto& t : threads) t.join();
+    }
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start).count();
+}
+
+void run_bench(const std::string& name, const bench_body_t& body,
+               int n_threads) {
+    uint64_t n_ops = 1000;
+    double elapsed = run_once(body, n_ops, n_threads);
+    while (elapsed < MIN_RUN_TIME && n_ops < MAX_OPS) {
+        n_ops *= elapsed > MIN_RUN_TIME / 10 ? 2 : 10;
+        elapsed = run_once(body, n_ops, n_threads);
+    }
+
+    double ns_per_op = elapsed * 1e9 / n_ops;
+    printf("%-56s %2d threads %10.2f ns/op %10.2f Mops/s\n", name.c_str(),
+           n_threads, ns_per_op, n_threads * n_ops / elapsed / 1e6);
+    fflush(stdout);
+}
+
+}  // namespace pm
+
+int main(int argc, char** argv) {
+    for (const auto& bench : pm::benches()) {
+        if (argc < 2 || strstr(bench.first, argv[1])) {
+            bench.second();
+        }
+    }
+    return 0;
+}
@@ -1,29 +1,172 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <cmath>
 #include <mutex>
+#include <new>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include <pm/time.h>
 
 namespace pm {
 
-struct spinlock_t {
-    spinlock_t() : locked_(false) {}
-    spinlock_t(const spinlock_t& ) : locked_(false) {}
+// locks used inside the library, see registry_t::lock_stats()
+enum lock_site_t {
+    DOUBLE_BUFFER_COUNTER_LOCK,
+    DECAYING_COUNTER_LOCK,
+    SPACE_SAVING_COUNTER_LOCK,
+    N_LOCK_SITES
+};
+
+// contention seen by all locks of a site, updated on slow path only and
+// only while enabled, each site on its own cache line
+struct alignas(64) spinlock_stats_t {
+    spinlock_stats_t() : contended(0), spins(0), yields(0) {}
+
+    // acquisitions that found lock taken
+    std::atomic<uint64_t> contended;
+    // pause instructions and yields while waiting
+    std::atomic<uint64_t> spins, yields;
+};
+
+inline spinlock_stats_t* lock_site_stats(lock_site_t site) {
+    static spinlock_stats_t stats[N_LOCK_SITES];
+    return &stats[site];
+}
+
+// number of lock_stats_t handles alive, stats are collected while non-zero
+inline std::atomic<int>& lock_stats_users() {
+    static std::atomic<int> users(0);
+    return users;
+}
+
+inline bool lock_stats_enabled() {
+    return lock_stats_users().load(std::memory_order_relaxed) > 0;
+}
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#else
+    asm volatile("" ::: "memory");
+#endif
+}
+
+// test-and-test-and-set lock. Waiters spin on a plain load with
+// exponential backoff, then fall back to yielding the CPU, so a preempted
+// holder isn't starved by spinning waiters.
+//
+// Contended acquisitions of locks with SITE below N_LOCK_SITES are counted
+// in lock_site_stats(SITE) while lock_stats_enabled().
+template <int SITE>
+struct basic_spinlock_t {
+    static const unsigned MAX_BACKOFF = 64;
+
+    basic_spinlock_t() : locked_(false) {}
+    basic_spinlock_t(const basic_spinlock_t&) : locked_(false) {}
 
     void lock() {
-        while (!locked_.test_and_set()) {}
+        if (!locked_.exchange(true, std::memory_order_acquire)) return;
+        lock_slow();
+    }
+
+    bool try_lock() {
+        return !locked_.load(std::memory_order_relaxed) &&
+               !locked_.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock() { locked_.store(false, std::memory_order_release); }
+
+private:
+    std::atomic<bool> locked_;
+
+    void lock_slow() {
+        uint64_t spins = 0, yields = 0;
+        unsigned backoff = 1;
+
+        do {
+            while (locked_.load(std::memory_order_relaxed)) {
+                if (backoff <= MAX_BACKOFF) {
+                    for (unsigned i = 0; i < backoff; ++i) cpu_relax();
+                    spins += backoff;
+                    backoff *= 2;
+                } else {
+                    std::this_thread::yield();
+                    ++yields;
+                }
+            }
+        } while (locked_.exchange(true, std::memory_order_acquire));
+
+        if (SITE < N_LOCK_SITES && lock_stats_enabled()) {
+            spinlock_stats_t* stats = lock_site_stats(lock_site_t(SITE));
+            stats->contended.fetch_add(1, std::memory_order_relaxed);
+            if (spins) stats->spins.fetch_add(spins, std::memory_order_relaxed);
+            if (yields) stats->yields.fetch_add(yields, std::memory_order_relaxed);
+        }
+    }
+};
+
+// lock without stats
+typedef basic_spinlock_t<N_LOCK_SITES> spinlock_t;
+
+// unsigned total that only grows and wraps around at 2^64. Threads are
+// assigned to N_STRIPES cache lines round robin, so add() is a single
+// fetch_add contended only by threads sharing the stripe (every
+// N_STRIPES-th thread).
+class striped_counter_t {
+public:
+    static const size_t N_STRIPES = 16;
+    static const size_t CACHE_LINE = 64;
+
+    striped_counter_t() {
+        for (size_t i = 0; i < N_STRIPES; ++i) {
+            new (stripe(i)) std::atomic<uint64_t>(0);
+        }
+    }
+
+    striped_counter_t(const striped_counter_t&) = delete;
+    striped_counter_t& operator = (const striped_counter_t&) = delete;
+
+    void add(uint64_t amount) {
+        stripe(thread_stripe())->fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    // unsigned sum wraps the same way as the total
+    uint64_t load() const {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < N_STRIPES; ++i) {
+            sum += stripe(i)->load(std::memory_order_relaxed);
+        }
+        return sum;
     }
 
-    void unlock() { locked_.clear(); }
+private:
+    char storage_[(N_STRIPES + 1) * CACHE_LINE];
 
-    std::atomic_flag locked_;
+    std::atomic<uint64_t>* stripe(size_t i) const {
+        uintptr_t aligned =
+            (uintptr_t(storage_) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+        return reinterpret_cast<std::atomic<uint64_t>*>(aligned + i * CACHE_LINE);
+    }
+
+    static size_t thread_stripe() {
+        static std::atomic<size_t> next(0);
+        static thread_local size_t stripe = 0;
+
+        if (!stripe) stripe = next.fetch_add(1, std::memory_order_relaxed) + 1;
+        return stripe % N_STRIPES;
+    }
 };
 
 class double_buffer_counter_t {
 public:
+    typedef basic_spinlock_t<DOUBLE_BUFFER_COUNTER_LOCK> lock_t;
+
     explicit double_buffer_counter_t(duration_t window_size)
         : window_size_(window_size),
           value_(0),
@@ -31,23 +174,23 @@ public:
           next_swap_(std::chrono::system_clock::now() + window_size_) {}
 
     int64_t value(time_point_t at) {
-        std::lock_guard<spinlock_t> guard(lock_);
+        std::lock_guard<lock_t> guard(lock_);
         maybe_swap(at);
 
         return value_;
     }
 
-    void mark(time_point_t at) {
-        std::lock_guard<spinlock_t> guard(lock_);
+    void mark(time_point_t at, int64_t count = 1) {
+        std::lock_guard<lock_t> guard(lock_);
         maybe_swap(at);
 
-        ++next_value_;
+        next_value_ += count;
     }
 
 private:
     const duration_t window_size_;
 
-    spinlock_t lock_;
+    lock_t lock_;
     int64_t value_, next_value_;
     time_point_t next_swap_;
 
@@ -62,21 +205,23 @@ private:
 
 class decaying_counter_t {
 public:
+    typedef basic_spinlock_t<DECAYING_COUNTER_LOCK> lock_t;
+
     explicit decaying_counter_t(duration_t decay_time)
         : decay_time_(decay_time),
           value_(0),
           last_(std::chrono::system_clock::now()) {}
 
     double value(time_point_t at) {
-        std::lock_guard<spinlock_t> guard(lock_);
+        std::lock_guard<lock_t> guard(lock_);
         decay(at);
         return value_;
     }
 
-    void mark(time_point_t at) {
-        std::lock_guard<spinlock_t> guard(lock_);
+    void mark(time_point_t at, double count = 1) {
+        std::lock_guard<lock_t> guard(lock_);
         decay(at);
-        value_ += 1;
+        value_ += count;
     }
 
 private:
@@ -93,7 +238,7 @@ private:
 
     time_point_t last_;
 
-    spinlock_t lock_;
+    lock_t lock_;
 };
 
 class linear_mapping_t {
@@ -102,6 +247,9 @@ public:
 
     int n_buckets() { return n_buckets_; }
 
+    double min() const { return min_; }
+    double max() const { return max_; }
+
     int map(double value) {
         int bucket = (value - min_) * n_buckets_ / (max_ - min_);
 
@@ -122,13 +270,28 @@ private:
 class histogram_counter_t {
 public:
     histogram_counter_t(duration_t interval, linear_mapping_t mapping)
-        : mapping_(mapping), histogram_(mapping.n_buckets(), decaying_counter_t(interval)), total_(interval) {}
+        : mapping_(mapping), histogram_(mapping.n_buckets(), decaying_counter_t(interval)), total_(interval),
+          underflow_(0), overflow_(0) {}
 
+    // values outside of mapping range are clamped into the edge buckets and
+    // counted in underflow()/overflow()
     void update(time_point_t at, double value) {
+        if (value < mapping_.min()) {
+            underflow_.fetch_add(1, std::memory_order_relaxed);
+        } else if (value > mapping_.max()) {
+            overflow_.fetch_add(1, std::memory_order_relaxed);
+        }
+
         total_.mark(at);
         histogram_[mapping_.map(value)].mark(at);
     }
 
+    // add count values falling into bucket at once
+    void update_bucket(time_point_t at, int bucket, double count) {
+        total_.mark(at, count);
+        histogram_[bucket].mark(at, count);
+    }
+
     void get_quantiles(time_point_t at, const std::vector<double>& quantiles, std::vector<double>* quantiles_value) {
         quantiles_value->resize(quantiles.size());
 
@@ -157,11 +320,472 @@ public:
         }
     }
 
+    // number of values below min and above max since creation
+    uint64_t underflow() const { return underflow_.load(std::memory_order_relaxed); }
+    uint64_t overflow() const { return overflow_.load(std::memory_order_relaxed); }
+
 private:
     linear_mapping_t mapping_;
 
     std::vector<decaying_counter_t> histogram_;
     decaying_counter_t total_;
+
+    std::atomic<uint64_t> underflow_, overflow_;
+};
+
+// histogram without preconfigured range. Positive values are split into
+// octaves [2^(e-1), 2^e), each octave into SUB_BUCKETS linear buckets, so
+// quantiles are within 1/SUB_BUCKETS of the true value on any scale.
+// Octave pages are allocated when first value falls into them, memory
+// grows with the observed range only.
+//
+// Values between zero and the lowest octave are kept in a zero bucket and
+// reported as 0. Negative values (underflow) go to the zero bucket too,
+// values above the highest octave (overflow) are reported as its upper
+// edge, both are counted.
+class auto_histogram_counter_t {
+public:
+    static const int SUB_BUCKETS = 32;
+    static const int MIN_EXPONENT = -20;
+    static const int MAX_EXPONENT = 44;
+    static const int N_OCTAVES = MAX_EXPONENT - MIN_EXPONENT;
+
+    explicit auto_histogram_counter_t(duration_t interval)
+        : interval_(interval), zero_(interval), total_(interval),
+          underflow_(0), overflow_(0), n_pages_(0) {
+        for (auto& page : pages_) page.store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~auto_histogram_counter_t() {
+        for (auto& page : pages_) delete page.load();
+    }
+
+    auto_histogram_counter_t(const auto_histogram_counter_t&) = delete;
+    auto_histogram_counter_t& operator = (const auto_histogram_counter_t&) = delete;
+
+    // flat bucket indexes, octave buckets are in between
+    static const int ZERO_BUCKET = 0;
+    static const int OVERFLOW_BUCKET = N_OCTAVES * SUB_BUCKETS + 1;
+    static const int N_BUCKETS = OVERFLOW_BUCKET + 1;
+
+    void update(time_point_t at, double value) {
+        // also true for NaN, ranked together with zeros
+        if (!(value >= 0)) underflow_.fetch_add(1, std::memory_order_relaxed);
+
+        int bucket = bucket_index(value);
+        if (bucket == OVERFLOW_BUCKET) overflow_.fetch_add(1, std::memory_order_relaxed);
+
+        update_bucket(at, bucket, 1);
+    }
+
+    // add count values falling into bucket at once, underflow and overflow
+    // are left to the caller
+    void update_bucket(time_point_t at, int bucket, double count) {
+        total_.mark(at, count);
+
+        if (bucket == ZERO_BUCKET) {
+            zero_.mark(at, count);
+        } else if (bucket != OVERFLOW_BUCKET) {
+            int octave = (bucket - 1) / SUB_BUCKETS;
+            get_page(octave)->buckets[(bucket - 1) % SUB_BUCKETS].mark(at, count);
+        }
+    }
+
+    // bucket of value for update_bucket(), negative values and NaN go to
+    // the zero bucket
+    static int bucket_index(double value) {
+        if (!(value >= 0)) return ZERO_BUCKET;
+
+        int exponent;
+        double mantissa = std::frexp(value, &exponent);
+        if (value == 0 || exponent < MIN_EXPONENT) return ZERO_BUCKET;
+        if (exponent >= MAX_EXPONENT || std::isinf(value)) return OVERFLOW_BUCKET;
+
+        int sub_bucket = (mantissa - 0.5) * 2 * SUB_BUCKETS;
+        return 1 + (exponent - MIN_EXPONENT) * SUB_BUCKETS + sub_bucket;
+    }
+
+    // middle of the bucket, overflow is reported as the highest edge
+    static double bucket_value(int bucket) {
+        if (bucket == ZERO_BUCKET) return 0;
+        if (bucket == OVERFLOW_BUCKET) return std::ldexp(1.0, MAX_EXPONENT - 1);
+
+        int octave = (bucket - 1) / SUB_BUCKETS, sub_bucket = (bucket - 1) % SUB_BUCKETS;
+        double mantissa = 0.5 + 0.5 * (sub_bucket + 0.5) / SUB_BUCKETS;
+        return std::ldexp(mantissa, octave + MIN_EXPONENT);
+    }
+
+    void get_quantiles(time_point_t at, const std::vector<double>& quantiles, std::vector<double>* quantiles_value) {
+        quantiles_value->assign(quantiles.size(), 0.0);
+
+        double total = total_.value(at);
+        if (total < 1.0) return;
+
+        size_t q = 0;
+        double sum = zero_.value(at);
+        while (q < quantiles.size() && sum >= quantiles[q] * total) ++q;
+
+        for (int octave = 0; octave < N_OCTAVES && q < quantiles.size(); ++octave) {
+            page_t* page = pages_[octave].load(std::memory_order_acquire);
+            if (!page) continue;
+
+            for (int i = 0; i < SUB_BUCKETS && q < quantiles.size(); ++i) {
+                sum += page->buckets[i].value(at);
+                while (q < quantiles.size() && sum >= quantiles[q] * total) {
+                    (*quantiles_value)[q] = bucket_upper_edge(octave, i);
+                    ++q;
+                }
+            }
+        }
+
+        for (; q < quantiles.size(); ++q) {
+            (*quantiles_value)[q] = std::ldexp(1.0, MAX_EXPONENT - 1);
+        }
+    }
+
+    // number of negative values and values above 2^(MAX_EXPONENT - 1)
+    // since creation
+    uint64_t underflow() const { return underflow_.load(std::memory_order_relaxed); }
+    uint64_t overflow() const { return overflow_.load(std::memory_order_relaxed); }
+
+    size_t memory_usage() const {
+        return sizeof(*this) +
+               n_pages_.load(std::memory_order_relaxed) *
+                   (sizeof(page_t) + SUB_BUCKETS * sizeof(decaying_counter_t));
+    }
+
+private:
+    struct page_t {
+        explicit page_t(duration_t interval)
+            : buckets(SUB_BUCKETS, decaying_counter_t(interval)) {}
+
+        std::vector<decaying_counter_t> buckets;
+    };
+
+    const duration_t interval_;
+
+    decaying_counter_t zero_, total_;
+    std::atomic<uint64_t> underflow_, overflow_;
+
+    std::atomic<page_t*> pages_[N_OCTAVES];
+    std::atomic<size_t> n_pages_;
+
+    static double bucket_upper_edge(int octave, int sub_bucket) {
+        double mantissa = 0.5 + 0.5 * (sub_bucket + 1) / SUB_BUCKETS;
+        return std::ldexp(mantissa, octave + MIN_EXPONENT);
+    }
+
+    // allocates only the first time octave is used, racing threads keep
+    // the page published first
+    page_t* get_page(int octave) {
+        page_t* page = pages_[octave].load(std::memory_order_acquire);
+        if (page) return page;
+
+        page_t* created = new page_t(interval_);
+        if (pages_[octave].compare_exchange_strong(page, created, std::memory_order_acq_rel)) {
+            n_pages_.fetch_add(1, std::memory_order_relaxed);
+            return created;
+        }
+
+        delete created;
+        return page;
+    }
+};
+
+// count, sum, min, max, mean and standard deviation of values, lock-free.
+//
+// count and sum are cumulative, so averages can be computed correctly
+// across hosts. The rest describe the previous complete window. Each of
+// the two window slots is tagged with its epoch and reset by the first
+// update of a new epoch. Variance is computed from sums of (x - K) and
+// (x - K)^2, where K is the first value of the window, which avoids
+// the cancellation of plain sums without Welford's per-update division
+// and serialized state. Updates racing with a reset may be dropped.
+class summary_counter_t {
+public:
+    struct summary_t {
+        int64_t count;
+        double min, max, mean, stddev;
+    };
+
+    explicit summary_counter_t(duration_t window_size)
+        : window_size_(std::chrono::duration_cast<std::chrono::nanoseconds>(window_size).count()),
+          count_(0), sum_(0) {}
+
+    // count equal values at once
+    void update(time_point_t at, double value, int64_t count = 1) {
+        count_.fetch_add(count, std::memory_order_relaxed);
+        atomic_add(&sum_, value * count);
+
+        int64_t epoch = get_epoch(at);
+        slot_t& slot = slots_[epoch & 1];
+
+        int64_t slot_epoch = slot.epoch.load(std::memory_order_acquire);
+        if (slot_epoch != epoch) {
+            // sample from a window that is already gone, or other thread
+            // is resetting the slot
+            if (slot_epoch > epoch || slot_epoch == RESETTING) return;
+
+            if (!slot.epoch.compare_exchange_strong(slot_epoch, RESETTING, std::memory_order_acquire)) {
+                return;
+            }
+            slot.reset(value);
+            slot.epoch.store(epoch, std::memory_order_release);
+        }
+
+        double delta = value - slot.shift.load(std::memory_order_relaxed);
+        slot.count.fetch_add(count, std::memory_order_relaxed);
+        atomic_add(&slot.sum, delta * count);
+        atomic_add(&slot.sum_squares, delta * delta * count);
+        atomic_min(&slot.min, value);
+        atomic_max(&slot.max, value);
+    }
+
+    // window statistics are zero if nothing was recorded
+    void get(time_point_t at, summary_t* summary) {
+        *summary = summary_t{0, 0, 0, 0, 0};
+
+        int64_t epoch = get_epoch(at) - 1;
+        slot_t& slot = slots_[epoch & 1];
+        if (slot.epoch.load(std::memory_order_acquire) != epoch) return;
+
+        int64_t n = slot.count.load(std::memory_order_relaxed);
+        if (n == 0) return;
+
+        double sum = slot.sum.load(std::memory_order_relaxed);
+        double sum_squares = slot.sum_squares.load(std::memory_order_relaxed);
+
+        summary->count = n;
+        summary->min = slot.min.load(std::memory_order_relaxed);
+        summary->max = slot.max.load(std::memory_order_relaxed);
+        summary->mean = slot.shift.load(std::memory_order_relaxed) + sum / n;
+        if (n > 1) {
+            double variance = (sum_squares - sum * sum / n) / (n - 1);
+            summary->stddev = std::sqrt(std::max(variance, 0.0));
+        }
+    }
+
+    int64_t count() const { return count_.load(std::memory_order_relaxed); }
+    double sum() const { return sum_.load(std::memory_order_relaxed); }
+
+private:
+    static const int64_t RESETTING = -1;
+
+    struct slot_t {
+        slot_t() : epoch(RESETTING - 1) { reset(0); }
+
+        void reset(double first) {
+            shift.store(first, std::memory_order_relaxed);
+            count.store(0, std::memory_order_relaxed);
+            sum.store(0, std::memory_order_relaxed);
+            sum_squares.store(0, std::memory_order_relaxed);
+            min.store(first, std::memory_order_relaxed);
+            max.store(first, std::memory_order_relaxed);
+        }
+
+        std::atomic<int64_t> epoch;
+        std::atomic<int64_t> count;
+        std::atomic<double> shift, sum, sum_squares, min, max;
+    };
+
+    const int64_t window_size_;
+
+    std::atomic<int64_t> count_;
+    std::atomic<double> sum_;
+
+    slot_t slots_[2];
+
+    int64_t get_epoch(time_point_t at) const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(at.time_since_epoch()).count() / window_size_;
+    }
+
+    static void atomic_add(std::atomic<double>* a, double value) {
+        double current = a->load(std::memory_order_relaxed);
+        while (!a->compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {}
+    }
+
+    static void atomic_min(std::atomic<double>* a, double value) {
+        double current = a->load(std::memory_order_relaxed);
+        while (value < current && !a->compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+
+    static void atomic_max(std::atomic<double>* a, double value) {
+        double current = a->load(std::memory_order_relaxed);
+        while (value > current && !a->compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+};
+
+// Space-Saving summary of the most frequent keys with exponentially decaying
+// counts. At most capacity keys are tracked, new key replaces the least
+// frequent one and inherits its count, so counts are overestimated by at
+// most the count of the least frequent key.
+//
+// Decay is applied by weighting marks with exp((at - landmark) / decay_time)
+// instead of touching every count, counts are rescaled when weights grow.
+class space_saving_counter_t {
+public:
+    typedef basic_spinlock_t<SPACE_SAVING_COUNTER_LOCK> lock_t;
+
+    space_saving_counter_t(duration_t decay_time, size_t capacity)
+        : decay_time_(decay_time),
+          capacity_(capacity),
+          landmark_(std::chrono::system_clock::now()),
+          table_mask_(table_size(capacity) - 1),
+          table_(table_mask_ + 1, 0) {
+        entries_.reserve(capacity);
+        heap_.reserve(capacity);
+    }
+
+    // heap memory is reserved up front, keys aren't counted
+    size_t memory_usage() const {
+        return sizeof(*this) + entries_.capacity() * sizeof(entry_t) +
+               heap_.capacity() * sizeof(uint32_t) +
+               table_.capacity() * sizeof(uint32_t);
+    }
+
+    void mark(time_point_t at, size_t hash, const std::string& key) {
+        std::lock_guard<lock_t> guard(lock_);
+        double weight = get_weight(at);
+
+        size_t slot = find(hash, key);
+        if (table_[slot]) {
+            entry_t& entry = entries_[table_[slot] - 1];
+            entry.count += weight;
+            sift_down(entry.heap_index);
+            return;
+        }
+
+        if (entries_.size() < capacity_) {
+            table_[slot] = entries_.size() + 1;
+            heap_.push_back(entries_.size());
+            entries_.push_back(entry_t{key, hash, weight, 0, heap_.size() - 1});
+            sift_up(heap_.size() - 1);
+            return;
+        }
+
+        uint32_t min = heap_[0];
+        entry_t& entry = entries_[min];
+        erase(find(entry.hash, entry.key));
+
+        entry.key.assign(key);
+        entry.hash = hash;
+        entry.error = entry.count;
+        entry.count += weight;
+
+        table_[find(hash, key)] = min + 1;
+        sift_down(0);
+    }
+
+    // decayed counts of tracked keys, in no particular order
+    void get(time_point_t at, std::vector<std::pair<std::string, double>>* counts) {
+        std::lock_guard<lock_t> guard(lock_);
+
+        double scale = exp(-(at - landmark_) / decay_time_);
+        for (const auto& entry : entries_) {
+            counts->emplace_back(entry.key, entry.count * scale);
+        }
+    }
+
+private:
+    struct entry_t {
+        std::string key;
+        size_t hash;
+        double count, error;
+        size_t heap_index;
+    };
+
+    static size_t table_size(size_t capacity) {
+        size_t size = 1;
+        while (size < 2 * capacity) size *= 2;
+        return size;
+    }
+
+    double get_weight(time_point_t at) {
+        double exponent = (at - landmark_) / decay_time_;
+        if (exponent < 32) return exp(exponent);
+
+        double scale = exp(-exponent);
+        for (auto& entry : entries_) {
+            entry.count *= scale;
+            entry.error *= scale;
+        }
+        landmark_ = at;
+        return 1;
+    }
+
+    // open addressing with linear probing, returns slot holding key or
+    // empty slot where it should be inserted
+    size_t find(size_t hash, const std::string& key) {
+        size_t slot = hash & table_mask_;
+        while (table_[slot]) {
+            const entry_t& entry = entries_[table_[slot] - 1];
+            if (entry.hash == hash && entry.key == key) break;
+            slot = (slot + 1) & table_mask_;
+        }
+        return slot;
+    }
+
+    // backward shift deletion, keeps probe sequences without tombstones
+    void erase(size_t slot) {
+        table_[slot] = 0;
+
+        size_t next = slot;
+        while (true) {
+            next = (next + 1) & table_mask_;
+            if (!table_[next]) break;
+
+            size_t home = entries_[table_[next] - 1].hash & table_mask_;
+            bool stays = slot <= next ? (slot < home && home <= next)
+                                      : (slot < home || home <= next);
+            if (!stays) {
+                table_[slot] = table_[next];
+                table_[next] = 0;
+                slot = next;
+            }
+        }
+    }
+
+    bool less(size_t a, size_t b) {
+        return entries_[heap_[a]].count < entries_[heap_[b]].count;
+    }
+
+    void swap(size_t a, size_t b) {
+        std::swap(heap_[a], heap_[b]);
+        entries_[heap_[a]].heap_index = a;
+        entries_[heap_[b]].heap_index = b;
+    }
+
+    void sift_up(size_t i) {
+        while (i > 0 && less(i, (i - 1) / 2)) {
+            swap(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+
+    void sift_down(size_t i) {
+        while (true) {
+            size_t smallest = i;
+            size_t left = 2 * i + 1, right = 2 * i + 2;
+            if (left < heap_.size() && less(left, smallest)) smallest = left;
+            if (right < heap_.size() && less(right, smallest)) smallest = right;
+            if (smallest == i) return;
+
+            swap(i, smallest);
+            i = smallest;
+        }
+    }
+
+    duration_t decay_time_;
+    size_t capacity_;
+    time_point_t landmark_;
+
+    std::vector<entry_t> entries_;
+    std::vector<uint32_t> heap_;
+
+    size_t table_mask_;
+    std::vector<uint32_t> table_;
+
+    lock_t lock_;
 };
 
 }  // namespace pm
@@ -1,5 +1,7 @@
 #include <pm/graphite.h>
 
+#include <pm/self.h>
+
 namespace pm {
 
 graphite_printer_t::graphite_printer_t(const std::string& prefix)
@@ -9,6 +11,16 @@ graphite_printer_t::graphite_printer_t(const std::string& prefix,
                                        int64_t timestamp)
     : path_({prefix}), timestamp_(timestamp) {}
 
+graphite_printer_t::~graphite_printer_t() {
+    self_stats_t& stats = self_stats();
+    std::streamoff bytes = result_.tellp();
+
+    // tellp() is -1 once the stream failed
+    if (stats.enabled() && bytes > 0) {
+        stats.graphite_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+}
+
 void graphite_printer_t::start_node() {}
 
 void graphite_printer_t::end_node() { path_.pop_back(); }
@@ -8,6 +8,7 @@ class graphite_printer_t : public tree_printer_t {
 public:
     graphite_printer_t(const std::string& prefix);
     graphite_printer_t(const std::string& prefix, int64_t timestamp);
+    ~graphite_printer_t();
 
     virtual void start_node();
     virtual void end_node();
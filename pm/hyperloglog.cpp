@@ -0,0 +1,362 @@
+#include <pm/hyperloglog.h>
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace pm {
+
+static const int RANK_BITS = 6;
+static const uint32_t RANK_MASK = (1u << RANK_BITS) - 1;
+
+static uint32_t entry_index(uint32_t entry) { return entry >> RANK_BITS; }
+static uint8_t entry_rank(uint32_t entry) { return entry & RANK_MASK; }
+
+// std::hash of integers is identity, mix bits so low-entropy hashes still
+// spread over registers
+static uint64_t mix(uint64_t hash) {
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+uint32_t hyperloglog_t::encode(uint64_t hash) {
+    hash = mix(hash);
+
+    uint32_t index = hash >> (64 - PRECISION);
+    uint64_t rest = hash << PRECISION;
+    uint32_t rank = rest ? __builtin_clzll(rest) + 1 : 64 - PRECISION + 1;
+    return (index << RANK_BITS) | rank;
+}
+
+static void max_registers(uint8_t* dst, const uint8_t* src, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_max_epu8(a, b));
+    }
+#endif
+    for (; i < n; ++i) dst[i] = std::max(dst[i], src[i]);
+}
+
+// sum of 2^-register and number of zero registers
+static void sum_registers(const uint8_t* registers, size_t n, double* sum,
+                          size_t* zeros) {
+    *sum = 0;
+    *zeros = 0;
+
+    size_t i = 0;
+#ifdef __SSE2__
+    // 2^-r as float is just the exponent field (127 - r) << 23, ranks are
+    // below 64 so it never underflows
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi32(127);
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 16 <= n; i += 16) {
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(registers + i));
+        *zeros += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(r, zero)));
+
+        __m128i lo = _mm_unpacklo_epi8(r, zero);
+        __m128i hi = _mm_unpackhi_epi8(r, zero);
+        __m128i parts[4] = {
+            _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+            _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero),
+        };
+        for (const auto& part : parts) {
+            __m128i bits = _mm_slli_epi32(_mm_sub_epi32(bias, part), 23);
+            acc = _mm_add_ps(acc, _mm_castsi128_ps(bits));
+        }
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    *sum = double(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < n; ++i) {
+        *sum += std::ldexp(1., -registers[i]);
+        if (registers[i] == 0) ++*zeros;
+    }
+}
+
+static double estimate_from(double sum, size_t zeros) {
+    const double m = hyperloglog_t::N_REGISTERS;
+    const double alpha = 0.7213 / (1 + 1.079 / m);
+
+    double estimate = alpha * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) {
+        // linear counting is more accurate for small sets
+        estimate = m * std::log(m / zeros);
+    }
+    return estimate;
+}
+
+void hyperloglog_t::add(uint64_t hash) { add_encoded(encode(hash)); }
+
+void hyperloglog_t::add_encoded(uint32_t entry) {
+    uint32_t index = entry_index(entry);
+
+    if (!sparse()) {
+        dense_[index] = std::max(dense_[index], entry_rank(entry));
+        return;
+    }
+
+    auto it = std::lower_bound(
+        sparse_.begin(), sparse_.end(), index,
+        [] (uint32_t e, uint32_t index) { return entry_index(e) < index; });
+    if (it != sparse_.end() && entry_index(*it) == index) {
+        *it = std::max(*it, entry);
+        return;
+    }
+
+    sparse_.insert(it, entry);
+    if (sparse_.size() > MAX_SPARSE_SIZE) to_dense();
+}
+
+void hyperloglog_t::to_dense() {
+    if (!sparse()) return;
+
+    dense_.assign(N_REGISTERS, 0);
+    for (uint32_t entry : sparse_) {
+        dense_[entry_index(entry)] = entry_rank(entry);
+    }
+    std::vector<uint32_t>().swap(sparse_);
+}
+
+void hyperloglog_t::merge(const hyperloglog_t& other) {
+    if (other.sparse()) {
+        for (uint32_t entry : other.sparse_) add_encoded(entry);
+        return;
+    }
+
+    to_dense();
+    max_registers(dense_.data(), other.dense_.data(), N_REGISTERS);
+}
+
+double hyperloglog_t::estimate() const {
+    double sum;
+    size_t zeros;
+
+    if (sparse()) {
+        zeros = N_REGISTERS - sparse_.size();
+        sum = zeros;
+        for (uint32_t entry : sparse_) sum += std::ldexp(1., -entry_rank(entry));
+    } else {
+        sum_registers(dense_.data(), N_REGISTERS, &sum, &zeros);
+    }
+
+    return estimate_from(sum, zeros);
+}
+
+// 'H', precision, then either 's' + uint32 count + uint32 entries or
+// 'd' + registers, integers are little endian
+std::string hyperloglog_t::serialize() const {
+    std::string data = {'H', char(PRECISION), sparse() ? 's' : 'd'};
+
+    auto put_uint32 = [&data] (uint32_t v) {
+        for (int i = 0; i < 4; ++i) data.push_back(char(v >> (8 * i)));
+    };
+
+    if (sparse()) {
+        put_uint32(sparse_.size());
+        for (uint32_t entry : sparse_) put_uint32(entry);
+    } else {
+        data.append(dense_.begin(), dense_.end());
+    }
+    return data;
+}
+
+bool hyperloglog_t::deserialize(const std::string& data) {
+    sparse_.clear();
+    dense_.clear();
+
+    const uint8_t max_rank = 64 - PRECISION + 1;
+    if (data.size() < 3 || data[0] != 'H' || data[1] != char(PRECISION)) {
+        return false;
+    }
+
+    if (data[2] == 'd') {
+        if (data.size() != 3 + N_REGISTERS) return false;
+        dense_.assign(data.begin() + 3, data.end());
+        for (uint8_t rank : dense_) {
+            if (rank > max_rank) {
+                dense_.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if (data[2] != 's' || data.size() < 7) return false;
+
+    auto get_uint32 = [&data] (size_t offset) {
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) {
+            v |= uint32_t(uint8_t(data[offset + i])) << (8 * i);
+        }
+        return v;
+    };
+
+    uint32_t n = get_uint32(3);
+    if (n > MAX_SPARSE_SIZE || data.size() != 7 + 4 * size_t(n)) return false;
+
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t entry = get_uint32(7 + 4 * i);
+        bool sorted = sparse_.empty() ||
+                      entry_index(sparse_.back()) < entry_index(entry);
+        if (entry_index(entry) >= N_REGISTERS || entry_rank(entry) == 0 ||
+            entry_rank(entry) > max_rank || !sorted) {
+            sparse_.clear();
+            return false;
+        }
+        sparse_.push_back(entry);
+    }
+    return true;
+}
+
+static int64_t to_nanoseconds(time_point_t at) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        at.time_since_epoch()).count();
+}
+
+cardinality_counter_t::window_t::window_t() : dense(nullptr) {
+    for (auto& slot : sparse) slot.store(0, std::memory_order_relaxed);
+}
+
+cardinality_counter_t::window_t::~window_t() { delete[] dense.load(); }
+
+void cardinality_counter_t::window_t::add(uint32_t entry) {
+    std::atomic<uint8_t>* registers = dense.load(std::memory_order_acquire);
+
+    if (!registers) {
+        uint32_t index = entry_index(entry);
+        size_t slot = (index * 0x9e3779b1u) % SPARSE_SIZE;
+
+        for (size_t probe = 0; probe < MAX_PROBES; ++probe) {
+            uint32_t current = sparse[slot].load(std::memory_order_relaxed);
+            while (!(current & SEALED)) {
+                if (current != 0 && entry_index(current) != index) break;
+                if (current >= entry) return;
+
+                // on failure current is reloaded and checked again
+                if (sparse[slot].compare_exchange_weak(
+                        current, entry, std::memory_order_relaxed)) {
+                    return;
+                }
+            }
+            if (current & SEALED) break;
+
+            slot = (slot + 1) % SPARSE_SIZE;
+        }
+
+        registers = seal();
+    }
+
+    std::atomic<uint8_t>& reg = registers[entry_index(entry)];
+    uint8_t rank = entry_rank(entry);
+    uint8_t current = reg.load(std::memory_order_relaxed);
+    while (current < rank &&
+           !reg.compare_exchange_weak(current, rank, std::memory_order_relaxed)) {
+    }
+}
+
+// freezes the set and publishes registers built from it. Every thread that
+// gets here builds the same registers, only one of them is kept.
+std::atomic<uint8_t>* cardinality_counter_t::window_t::seal() {
+    std::atomic<uint8_t>* registers = new std::atomic<uint8_t>[hyperloglog_t::N_REGISTERS];
+    for (size_t i = 0; i < hyperloglog_t::N_REGISTERS; ++i) {
+        registers[i].store(0, std::memory_order_relaxed);
+    }
+
+    for (auto& slot : sparse) {
+        uint32_t entry = slot.fetch_or(SEALED, std::memory_order_relaxed) & ~SEALED;
+        if (entry) {
+            registers[entry_index(entry)].store(entry_rank(entry),
+                                                std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<uint8_t>* expected = nullptr;
+    if (dense.compare_exchange_strong(expected, registers,
+                                      std::memory_order_acq_rel)) {
+        return registers;
+    }
+
+    delete[] registers;
+    return expected;
+}
+
+// registers are kept once allocated, a window that overflowed the set is
+// likely to overflow it again
+void cardinality_counter_t::window_t::reset() {
+    std::atomic<uint8_t>* registers = dense.load(std::memory_order_acquire);
+    if (registers) {
+        for (size_t i = 0; i < hyperloglog_t::N_REGISTERS; ++i) {
+            registers[i].store(0, std::memory_order_relaxed);
+        }
+    } else {
+        for (auto& slot : sparse) slot.store(0, std::memory_order_relaxed);
+    }
+}
+
+void cardinality_counter_t::window_t::get(hyperloglog_t* sketch) {
+    sketch->sparse_.clear();
+    sketch->dense_.clear();
+
+    std::atomic<uint8_t>* registers = dense.load(std::memory_order_acquire);
+    if (registers) {
+        sketch->dense_.resize(hyperloglog_t::N_REGISTERS);
+        for (size_t i = 0; i < hyperloglog_t::N_REGISTERS; ++i) {
+            sketch->dense_[i] = registers[i].load(std::memory_order_relaxed);
+        }
+        return;
+    }
+
+    for (auto& slot : sparse) {
+        uint32_t entry = slot.load(std::memory_order_relaxed) & ~SEALED;
+        if (entry) sketch->add_encoded(entry);
+    }
+}
+
+cardinality_counter_t::cardinality_counter_t(duration_t window_size)
+    : window_size_(std::chrono::duration_cast<std::chrono::nanoseconds>(
+          window_size).count()),
+      next_swap_(to_nanoseconds(std::chrono::system_clock::now()) + window_size_),
+      current_(0) {}
+
+cardinality_counter_t::~cardinality_counter_t() {}
+
+void cardinality_counter_t::maybe_swap(int64_t at) {
+    int64_t swap = next_swap_.load(std::memory_order_relaxed);
+    if (at < swap) return;
+    if (!next_swap_.compare_exchange_strong(swap, at + window_size_,
+                                            std::memory_order_relaxed)) {
+        return;
+    }
+
+    int current = current_.load(std::memory_order_relaxed);
+    windows_[1 - current].reset();
+    current_.store(1 - current, std::memory_order_release);
+
+    // nothing was added during the whole previous window
+    if (at - swap >= window_size_) windows_[current].reset();
+}
+
+void cardinality_counter_t::add(time_point_t at, uint64_t hash) {
+    maybe_swap(to_nanoseconds(at));
+    windows_[current_.load(std::memory_order_acquire)].add(
+        hyperloglog_t::encode(hash));
+}
+
+void cardinality_counter_t::get(time_point_t at, hyperloglog_t* sketch) {
+    maybe_swap(to_nanoseconds(at));
+    windows_[1 - current_.load(std::memory_order_acquire)].get(sketch);
+}
+
+}  // namespace pm
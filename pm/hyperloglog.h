@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <pm/time.h>
+
+namespace pm {
+
+// HyperLogLog sketch of a set of hashes, used to estimate number of
+// distinct elements and to merge sketches from different instances.
+//
+// Small sets are kept as sorted list of (register, rank) pairs and switch
+// to array of registers when the list would take more memory.
+class hyperloglog_t {
+public:
+    static const int PRECISION = 11;
+    static const size_t N_REGISTERS = size_t(1) << PRECISION;
+    static const size_t MAX_SPARSE_SIZE = N_REGISTERS / sizeof(uint32_t);
+
+    void add(uint64_t hash);
+    void merge(const hyperloglog_t& other);
+    double estimate() const;
+
+    bool sparse() const { return dense_.empty(); }
+
+    std::string serialize() const;
+    // false if data is malformed, sketch is left empty in that case
+    bool deserialize(const std::string& data);
+
+    // private
+    static uint32_t encode(uint64_t hash);
+
+    void add_encoded(uint32_t entry);
+    void to_dense();
+
+    std::vector<uint32_t> sparse_;
+    std::vector<uint8_t> dense_;
+};
+
+// windowed sketch with lock-free add(), reports distinct hashes seen
+// during the previous window.
+//
+// Each window starts with a small open addressing set of (register, rank)
+// pairs. When the set fills up it is sealed and the first thread to notice
+// publishes array of registers built from it.
+class cardinality_counter_t {
+public:
+    explicit cardinality_counter_t(duration_t window_size);
+    ~cardinality_counter_t();
+
+    cardinality_counter_t(const cardinality_counter_t&) = delete;
+    cardinality_counter_t& operator = (const cardinality_counter_t&) = delete;
+
+    void add(time_point_t at, uint64_t hash);
+
+    // sketch of the previous complete window
+    void get(time_point_t at, hyperloglog_t* sketch);
+
+private:
+    static const size_t SPARSE_SIZE = 128;
+    static const size_t MAX_PROBES = 8;
+    static const uint32_t SEALED = uint32_t(1) << 31;
+
+    struct window_t {
+        window_t();
+        ~window_t();
+
+        void add(uint32_t entry);
+        void reset();
+        void get(hyperloglog_t* sketch);
+
+        std::atomic<uint32_t> sparse[SPARSE_SIZE];
+        std::atomic<std::atomic<uint8_t>*> dense;
+
+        std::atomic<uint8_t>* seal();
+    };
+
+    const int64_t window_size_;
+    std::atomic<int64_t> next_swap_;
+    std::atomic<int> current_;
+
+    window_t windows_[2];
+
+    void maybe_swap(int64_t at);
+};
+
+}  // namespace pm
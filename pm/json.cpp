@@ -0,0 +1,189 @@
+#include <pm/json.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+
+namespace pm {
+
+static const size_t FLUSH_SIZE = 64 * 1024;
+
+static const char HEX[] = "0123456789abcdef";
+
+static void append_uint(std::string* out, uint64_t v) {
+    char digits[20];
+    char* begin = digits + sizeof(digits);
+    do {
+        *--begin = '0' + v % 10;
+        v /= 10;
+    } while (v);
+
+    out->append(begin, digits + sizeof(digits) - begin);
+}
+
+static void append_int(std::string* out, int64_t v) {
+    if (v < 0) {
+        out->push_back('-');
+        append_uint(out, -uint64_t(v));
+    } else {
+        append_uint(out, v);
+    }
+}
+
+static void append_double(std::string* out, double v) {
+    if (!std::isfinite(v)) {
+        out->append("null");
+        return;
+    }
+
+    // values with at most 6 decimal places (counts, most quantiles) are
+    // formatted exactly without going through printf
+    double abs = std::fabs(v);
+    double scaled_abs = abs * 1e6;
+    if (abs < 1e9 && scaled_abs == std::floor(scaled_abs) &&
+        scaled_abs / 1e6 == abs) {
+        uint64_t scaled = uint64_t(scaled_abs);
+        uint64_t integer = scaled / 1000000, fraction = scaled % 1000000;
+
+        if (v < 0 && scaled != 0) out->push_back('-');
+        append_uint(out, integer);
+
+        if (fraction) {
+            char digits[7] = {};
+            int n = 6;
+            while (fraction % 10 == 0) {
+                fraction /= 10;
+                --n;
+            }
+            for (int i = n - 1; i >= 0; --i) {
+                digits[i] = '0' + fraction % 10;
+                fraction /= 10;
+            }
+
+            out->push_back('.');
+            out->append(digits, n);
+        }
+        return;
+    }
+
+    // shortest of 15 to 17 significant digits that reads back as v
+    char buffer[32];
+    int n = 0;
+    for (int precision = 15; precision <= 17; ++precision) {
+        n = snprintf(buffer, sizeof(buffer), "%.*g", precision, v);
+        if (strtod(buffer, nullptr) == v) break;
+    }
+    out->append(buffer, n);
+}
+
+static bool needs_escape(char c) {
+    return c == '"' || c == '\\' || uint8_t(c) < 0x20;
+}
+
+static void append_string(std::string* out, const std::string& s) {
+    out->push_back('"');
+
+    // runs of plain characters, usually the whole name, are appended at once
+    const char* begin = s.data();
+    const char* end = begin + s.size();
+    while (begin != end) {
+        const char* plain = begin;
+        while (plain != end && !needs_escape(*plain)) ++plain;
+        out->append(begin, plain - begin);
+        if (plain == end) break;
+
+        char c = *plain;
+        begin = plain + 1;
+        switch (c) {
+            case '"': out->append("\\\""); break;
+            case '\\': out->append("\\\\"); break;
+            case '\n': out->append("\\n"); break;
+            case '\r': out->append("\\r"); break;
+            case '\t': out->append("\\t"); break;
+            default:
+                out->append("\\u00");
+                out->push_back(HEX[uint8_t(c) >> 4]);
+                out->push_back(HEX[uint8_t(c) & 0xf]);
+        }
+    }
+    out->push_back('"');
+}
+
+json_printer_t::json_printer_t() : fd_(-1) {}
+
+json_printer_t::json_printer_t(int fd) : fd_(fd) {}
+
+json_printer_t::~json_printer_t() { flush(); }
+
+void json_printer_t::start_node() {
+    buffer_.push_back('{');
+    first_.push_back(true);
+}
+
+void json_printer_t::end_node() {
+    buffer_.push_back('}');
+    first_.pop_back();
+
+    if (first_.empty()) {
+        buffer_.push_back('\n');
+        maybe_flush();
+    }
+}
+
+void json_printer_t::child(const std::string& name) {
+    if (!first_.back()) buffer_.push_back(',');
+    first_.back() = false;
+
+    append_string(&buffer_, name);
+    buffer_.push_back(':');
+}
+
+void json_printer_t::value(double v) {
+    append_double(&buffer_, v);
+    maybe_flush();
+}
+
+void json_printer_t::value(int64_t v) {
+    append_int(&buffer_, v);
+    maybe_flush();
+}
+
+void json_printer_t::value(uint64_t v) {
+    append_uint(&buffer_, v);
+    maybe_flush();
+}
+
+std::string json_printer_t::result() const { return buffer_; }
+
+void json_printer_t::clear() {
+    buffer_.clear();
+    first_.clear();
+}
+
+void json_printer_t::flush() {
+    if (fd_ < 0) return;
+
+    size_t written = 0;
+    while (written < buffer_.size()) {
+        ssize_t res =
+            write(fd_, buffer_.data() + written, buffer_.size() - written);
+        if (res < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        written += res;
+    }
+
+    buffer_.clear();
+}
+
+void json_printer_t::maybe_flush() {
+    if (fd_ >= 0 && (buffer_.size() >= FLUSH_SIZE || first_.empty())) {
+        flush();
+    }
+}
+
+}  // namespace pm
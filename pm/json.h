@@ -0,0 +1,39 @@
+#pragma once
+
+#include <pm/tree.h>
+
+namespace pm {
+
+// prints tree as nested json object, one document per line.
+//
+// Output is appended to internal buffer, which is either kept until
+// clear() or written to file descriptor as it fills up.
+class json_printer_t : public tree_printer_t {
+public:
+    json_printer_t();
+    explicit json_printer_t(int fd);
+    ~json_printer_t();
+
+    virtual void start_node();
+    virtual void end_node();
+
+    virtual void child(const std::string& name);
+    virtual void value(double value);
+    virtual void value(int64_t value);
+    virtual void value(uint64_t value);
+
+    virtual std::string result() const;
+
+    // drop printed output, but keep allocated memory for the next print
+    void clear();
+    void flush();
+
+private:
+    int fd_;
+    std::string buffer_;
+    std::vector<bool> first_;
+
+    void maybe_flush();
+};
+
+}  // namespace pm
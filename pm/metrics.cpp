@@ -1,19 +1,29 @@
 #include <pm/metrics.h>
 
+#include <algorithm>
 #include <mutex>
 #include <atomic>
 #include <map>
 #include <iostream>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
 
 #include <pm/tree.h>
 #include <pm/counter.h>
+#include <pm/hyperloglog.h>
+#include <pm/quantile.h>
+#include <pm/self.h>
 
 namespace pm {
 
 struct counter_impl_t : public tree_leaf_t {
+    counter_impl_t() : value(0) {}
+
     virtual void print(tree_printer_t* printer) { printer->value(value); }
 
     std::atomic<int64_t> value;
+    self_tracked_t tracked;
 };
 
 void counter_t::inc(int64_t amount) {
@@ -28,6 +38,17 @@ void counter_t::set(int64_t value) {
     if (impl_) impl_->value = value;
 }
 
+struct monotonic_counter_impl_t : public tree_leaf_t {
+    virtual void print(tree_printer_t* printer) { printer->monotonic(total.load()); }
+
+    striped_counter_t total;
+    self_tracked_t tracked;
+};
+
+void monotonic_counter_t::inc(uint64_t amount) {
+    if (impl_) impl_->total.add(amount);
+}
+
 struct meter_impl_t : public tree_leaf_t {
     meter_impl_t()
         : one_sec(std::chrono::seconds(1)),
@@ -38,7 +59,7 @@ struct meter_impl_t : public tree_leaf_t {
     virtual void print(tree_printer_t* printer) {
         printer->start_node();
 
-        auto now = std::chrono::system_clock::now();
+        auto now = printer->now();
 
         printer->child("one_sec");
         printer->value(one_sec.value(now));
@@ -55,55 +76,101 @@ struct meter_impl_t : public tree_leaf_t {
         printer->end_node();
     }
 
-    virtual void mark() {
+    virtual void mark(int64_t count = 1) {
         auto now = std::chrono::system_clock::now();
 
-        one_sec.mark(now);
-        one_min.mark(now);
-        quarter_hour.mark(now);
-        one_hour.mark(now);
+        one_sec.mark(now, count);
+        one_min.mark(now, count);
+        quarter_hour.mark(now, count);
+        one_hour.mark(now, count);
     }
 
     double_buffer_counter_t one_sec;
     decaying_counter_t one_min, quarter_hour, one_hour;
+    self_tracked_t tracked;
 };
 
-void meter_t::mark() {
+void meter_t::mark(int64_t count) {
     if (impl_) {
-        impl_->mark();
+        impl_->mark(count);
     }
 }
 
-static std::vector<double> QUANTILES = { .5, .8, .9, .95, .99 };
-
 struct histogram_impl_t : public tree_leaf_t {
-    histogram_impl_t(int min, int max)
-        : histogram_five_min(std::chrono::minutes(5), linear_mapping_t(min, max, 1000)) {}
+    histogram_impl_t(int min, int max, const std::vector<double>& quantiles)
+        : linear(new histogram_counter_t(std::chrono::minutes(5), linear_mapping_t(min, max, 1000))),
+          summary(std::chrono::minutes(1)),
+          quantiles(quantiles) {}
+
+    explicit histogram_impl_t(const std::vector<double>& quantiles)
+        : automatic(new auto_histogram_counter_t(std::chrono::minutes(5))),
+          summary(std::chrono::minutes(1)),
+          quantiles(quantiles) {}
 
     virtual void print(tree_printer_t* printer) {
+        auto now = printer->now();
+
         std::vector<double> qvalues;
+        if (linear) {
+            linear->get_quantiles(now, quantiles.values, &qvalues);
+        } else {
+            automatic->get_quantiles(now, quantiles.values, &qvalues);
+        }
 
-        histogram_five_min.get_quantiles(std::chrono::system_clock::now(), QUANTILES, &qvalues);
+        summary_counter_t::summary_t window;
+        summary.get(now, &window);
 
         printer->start_node();
-        printer->child("q50");
-        printer->value(qvalues[0]);
-        printer->child("q80");
-        printer->value(qvalues[1]);
-        printer->child("q90");
-        printer->value(qvalues[2]);
-        printer->child("q95");
-        printer->value(qvalues[3]);
-        printer->child("q99");
-        printer->value(qvalues[4]);
+        for (size_t i = 0; i < quantiles.values.size(); ++i) {
+            printer->child(quantiles.names[i]);
+            printer->value(qvalues[i]);
+        }
+        printer->child("count");
+        printer->value(summary.count());
+        printer->child("sum");
+        printer->value(summary.sum());
+        printer->child("min");
+        printer->value(window.min);
+        printer->child("max");
+        printer->value(window.max);
+        printer->child("mean");
+        printer->value(window.mean);
+        printer->child("stddev");
+        printer->value(window.stddev);
+        printer->child("underflow");
+        printer->value(linear ? linear->underflow() : automatic->underflow());
+        printer->child("overflow");
+        printer->value(linear ? linear->overflow() : automatic->overflow());
         printer->end_node();
     }
 
     void update(double value) {
-        histogram_five_min.update(std::chrono::system_clock::now(), value);
+        auto now = std::chrono::system_clock::now();
+        if (linear) {
+            linear->update(now, value);
+        } else {
+            automatic->update(now, value);
+        }
+        summary.update(now, value);
+    }
+
+    size_t memory_usage() const {
+        size_t bytes = sizeof(*this);
+        if (linear) bytes += sizeof(histogram_counter_t) + 1000 * sizeof(decaying_counter_t);
+        if (automatic) bytes += automatic->memory_usage();
+        return bytes;
     }
 
-    histogram_counter_t histogram_five_min;
+    // exactly one of them is set
+    std::unique_ptr<histogram_counter_t> linear;
+    std::unique_ptr<auto_histogram_counter_t> automatic;
+
+    // min, max, mean and stddev are over the previous minute
+    summary_counter_t summary;
+
+    quantiles_t quantiles;
+
+    self_tracked_t tracked;
 };
 
 void histogram_t::update(int64_t value) {
@@ -113,7 +180,8 @@ void histogram_t::update(int64_t value) {
 }
 
 struct timer_impl_t : public tree_leaf_t {
-    timer_impl_t() : timings(0, 1000) {}
+    explicit timer_impl_t(const std::vector<double>& quantiles)
+        : active_count(0), timings(quantiles) {}
 
     virtual void print(tree_printer_t* printer) {
         printer->start_node();
@@ -128,9 +196,261 @@ struct timer_impl_t : public tree_leaf_t {
         printer->end_node();
     }
 
+    time_point_t start() {
+        active_count += 1;
+        rate.mark();
+
+        return std::chrono::system_clock::now();
+    }
+
+    void finish(time_point_t start_time) {
+        active_count -= 1;
+
+        auto now = time_point_t(std::chrono::system_clock::now());
+        timings.update(std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time).count());
+    }
+
+    void update(int64_t milliseconds) {
+        rate.mark();
+        timings.update(milliseconds);
+    }
+
+    size_t memory_usage() const {
+        return sizeof(*this) - sizeof(timings) + timings.memory_usage();
+    }
+
     std::atomic<int64_t> active_count;
     meter_impl_t rate;
     histogram_impl_t timings;
+    self_tracked_t tracked;
+};
+
+// keys become path components, so whitespace and control characters,
+// which would break line based output, are replaced with '_'
+static void sanitize_key(std::string* key) {
+    if (key->empty()) key->push_back('_');
+    for (char& c : *key) {
+        if (uint8_t(c) <= ' ' || c == 0x7f) c = '_';
+    }
+}
+
+struct top_k_impl_t : public tree_leaf_t {
+    static const size_t N_SHARDS = 8;
+
+    // shards keep twice as many keys as exported to make counts of the top
+    // keys more accurate
+    top_k_impl_t(int k) : k(k) {
+        shards.reserve(N_SHARDS);
+        for (size_t i = 0; i < N_SHARDS; ++i) {
+            shards.emplace_back(std::chrono::seconds(60), 2 * k);
+        }
+    }
+
+    virtual void print(tree_printer_t* printer) {
+        auto now = printer->now();
+
+        std::vector<std::pair<std::string, double>> counts;
+        for (auto& shard : shards) {
+            shard.get(now, &counts);
+        }
+
+        // keys that differ only in replaced characters are reported together
+        for (auto& count : counts) sanitize_key(&count.first);
+        std::sort(counts.begin(), counts.end());
+        size_t n_keys = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            if (n_keys > 0 && counts[n_keys - 1].first == counts[i].first) {
+                counts[n_keys - 1].second += counts[i].second;
+            } else {
+                if (n_keys != i) counts[n_keys] = std::move(counts[i]);
+                ++n_keys;
+            }
+        }
+        counts.resize(n_keys);
+
+        size_t n = std::min<size_t>(k, counts.size());
+        std::partial_sort(counts.begin(), counts.begin() + n, counts.end(),
+                          [] (const std::pair<std::string, double>& a,
+                              const std::pair<std::string, double>& b) {
+                              return a.second > b.second;
+                          });
+
+        printer->start_node();
+        for (size_t i = 0; i < n; ++i) {
+            printer->child(counts[i].first);
+            printer->value(counts[i].second / 60.);
+        }
+        printer->end_node();
+    }
+
+    void mark(const std::string& key) {
+        size_t hash = std::hash<std::string>()(key);
+        shards[(hash >> 32) % N_SHARDS].mark(std::chrono::system_clock::now(),
+                                             hash, key);
+    }
+
+    size_t memory_usage() const {
+        size_t bytes = sizeof(*this);
+        for (const auto& shard : shards) bytes += shard.memory_usage();
+        return bytes;
+    }
+
+    size_t k;
+    std::vector<space_saving_counter_t> shards;
+    self_tracked_t tracked;
+};
+
+void top_k_t::mark(const std::string& key) {
+    if (impl_) {
+        impl_->mark(key);
+    }
+}
+
+struct cardinality_impl_t : public tree_leaf_t {
+    cardinality_impl_t() : distinct(std::chrono::seconds(60)) {}
+
+    virtual void print(tree_printer_t* printer) {
+        hyperloglog_t sketch;
+        distinct.get(printer->now(), &sketch);
+        printer->value(int64_t(std::llround(sketch.estimate())));
+    }
+
+    cardinality_counter_t distinct;
+    self_tracked_t tracked;
+};
+
+void cardinality_t::add(uint64_t hash) {
+    if (impl_) {
+        impl_->distinct.add(std::chrono::system_clock::now(), hash);
+    }
+}
+
+void cardinality_t::add(const std::string& key) {
+    if (impl_) {
+        impl_->distinct.add(std::chrono::system_clock::now(),
+                            std::hash<std::string>()(key));
+    }
+}
+
+void cardinality_t::get(hyperloglog_t* sketch) {
+    if (impl_) {
+        impl_->distinct.get(std::chrono::system_clock::now(), sketch);
+    } else {
+        *sketch = hyperloglog_t();
+    }
+}
+
+struct lock_stats_impl_t : public tree_leaf_t {
+    lock_stats_impl_t() { ++lock_stats_users(); }
+    ~lock_stats_impl_t() { --lock_stats_users(); }
+
+    virtual void print(tree_printer_t* printer) {
+        static const char* SITE_NAMES[N_LOCK_SITES] = {
+            "double_buffer_counter", "decaying_counter", "space_saving_counter"};
+
+        printer->start_node();
+        for (int site = 0; site < N_LOCK_SITES; ++site) {
+            spinlock_stats_t* stats = lock_site_stats(lock_site_t(site));
+
+            printer->child(SITE_NAMES[site]);
+            printer->start_node();
+            printer->child("contended");
+            printer->value(stats->contended.load(std::memory_order_relaxed));
+            printer->child("spins");
+            printer->value(stats->spins.load(std::memory_order_relaxed));
+            printer->child("yields");
+            printer->value(stats->yields.load(std::memory_order_relaxed));
+            printer->end_node();
+        }
+        printer->end_node();
+    }
+};
+
+struct self_metrics_impl_t : public tree_leaf_t {
+    self_metrics_impl_t()
+        : registrations(self_stats().registrations.load()),
+          registration_rate(0),
+          last_print(std::chrono::system_clock::now()) {
+        ++self_stats().users;
+    }
+    ~self_metrics_impl_t() { --self_stats().users; }
+
+    // registrations since the previous print are decayed as if they all
+    // happened now, so registration takes no lock. Prints of a leaf are
+    // serialized by the branch mutex.
+    double registrations_one_min(time_point_t now) {
+        uint64_t current = self_stats().registrations.load(std::memory_order_relaxed);
+        if (now > last_print) {
+            registration_rate *= exp(-(now - last_print) / duration_t(std::chrono::seconds(60)));
+            last_print = now;
+        }
+        registration_rate += current - registrations;
+        registrations = current;
+
+        return registration_rate / 60.;
+    }
+
+    virtual void print(tree_printer_t* printer) {
+        static const char* TYPE_NAMES[N_METRIC_TYPES] = {
+            "counter", "monotonic_counter", "meter", "histogram", "timer",
+            "top_k", "cardinality"};
+
+        self_stats_t& stats = self_stats();
+        auto now = printer->now();
+
+        printer->start_node();
+
+        printer->child("live");
+        printer->start_node();
+        for (int type = 0; type < N_METRIC_TYPES; ++type) {
+            printer->child(TYPE_NAMES[type]);
+            printer->value(int64_t(stats.live[type].load(std::memory_order_relaxed)));
+        }
+        printer->end_node();
+
+        printer->child("memory");
+        printer->start_node();
+        printer->child("impl_bytes");
+        printer->value(int64_t(stats.impl_bytes.load(std::memory_order_relaxed)));
+        printer->child("tree_bytes");
+        printer->value(int64_t(stats.tree_bytes.load(std::memory_order_relaxed)));
+        printer->end_node();
+
+        printer->child("registrations");
+        printer->start_node();
+        printer->child("count");
+        printer->value(stats.registrations.load(std::memory_order_relaxed));
+        printer->child("one_min");
+        printer->value(registrations_one_min(now));
+        printer->end_node();
+
+        // duration of the previous print, current one is still running
+        printer->child("print");
+        printer->start_node();
+        printer->child("count");
+        printer->value(stats.prints.load(std::memory_order_relaxed));
+        printer->child("last_ms");
+        printer->value(stats.last_print_ns.load(std::memory_order_relaxed) / 1e6);
+        printer->child("total_ms");
+        printer->value(stats.print_ns.load(std::memory_order_relaxed) / 1e6);
+        printer->child("graphite_bytes");
+        printer->value(stats.graphite_bytes.load(std::memory_order_relaxed));
+        printer->end_node();
+
+        printer->child("tree_lock");
+        printer->start_node();
+        printer->child("waits");
+        printer->value(stats.tree_lock_waits.load(std::memory_order_relaxed));
+        printer->child("wait_ms");
+        printer->value(stats.tree_lock_wait_ns.load(std::memory_order_relaxed) / 1e6);
+        printer->end_node();
+
+        printer->end_node();
+    }
+
+    uint64_t registrations;
+    double registration_rate;
+    time_point_t last_print;
 };
 
 timer_context_t::timer_context_t(timer_t* timer)
@@ -144,25 +464,72 @@ void timer_context_t::finish() {
 }
 
 time_point_t timer_t::start() {
-    if (impl_) {
-        impl_->active_count += 1;
-        impl_->rate.mark();
-
-        return std::chrono::system_clock::now();
-    } else {
-        return time_point_t();
-    }
+    return impl_ ? impl_->start() : time_point_t();
 }
 
 void timer_t::finish(time_point_t start_time) {
     if (impl_) {
-        impl_->active_count -= 1;
+        impl_->finish(start_time);
+    }
+}
 
-        auto now = time_point_t(std::chrono::system_clock::now());
-        impl_->timings.update(std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time).count());
+void timer_t::update(int64_t milliseconds) {
+    if (impl_) {
+        impl_->update(milliseconds);
     }
 }
 
+// registers impl as owned leaf and tracks it, or takes the one already
+// owned under name
+template <class impl_t>
+static impl_t* add_ref_leaf(tree_branch_t* tree, const std::string& name,
+                            impl_t* impl, metric_type_t type, size_t bytes) {
+    std::shared_ptr<tree_leaf_t> created(impl);
+    std::shared_ptr<tree_leaf_t> leaf = tree->add_owned_leaf(name, created);
+    if (leaf == created) impl->tracked.track(type, bytes);
+    return static_cast<impl_t*>(leaf.get());
+}
+
+counter_ref_t::counter_ref_t() : impl_(nullptr) {}
+
+void counter_ref_t::inc(int64_t amount) {
+    if (impl_) impl_->value += amount;
+}
+
+void counter_ref_t::dec(int64_t amount) {
+    if (impl_) impl_->value -= amount;
+}
+
+void counter_ref_t::set(int64_t value) {
+    if (impl_) impl_->value = value;
+}
+
+meter_ref_t::meter_ref_t() : impl_(nullptr) {}
+
+void meter_ref_t::mark(int64_t count) {
+    if (impl_) impl_->mark(count);
+}
+
+histogram_ref_t::histogram_ref_t() : impl_(nullptr) {}
+
+void histogram_ref_t::update(int64_t value) {
+    if (impl_) impl_->update(value);
+}
+
+timer_ref_t::timer_ref_t() : impl_(nullptr) {}
+
+time_point_t timer_ref_t::start() {
+    return impl_ ? impl_->start() : time_point_t();
+}
+
+void timer_ref_t::finish(time_point_t start_time) {
+    if (impl_) impl_->finish(start_time);
+}
+
+void timer_ref_t::update(int64_t milliseconds) {
+    if (impl_) impl_->update(milliseconds);
+}
+
 registry_t::registry_t() : tree_(nullptr) {}
 registry_t::registry_t(std::shared_ptr<tree_branch_t> branch)
     : tree_(branch) {}
@@ -179,6 +546,7 @@ counter_t registry_t::counter(const std::string& name) {
     if (tree_) {
         auto counter_impl = std::make_shared<counter_impl_t>();
         tree_->add_leaf(name, counter_impl);
+        counter_impl->tracked.track(COUNTER_METRIC, sizeof(counter_impl_t));
         counter_t counter;
         counter.impl_ = counter_impl;
         return counter;
@@ -187,10 +555,25 @@ counter_t registry_t::counter(const std::string& name) {
     }
 }
 
+monotonic_counter_t registry_t::monotonic_counter(const std::string& name) {
+    if (tree_) {
+        auto counter_impl = std::make_shared<monotonic_counter_impl_t>();
+        tree_->add_leaf(name, counter_impl);
+        counter_impl->tracked.track(MONOTONIC_COUNTER_METRIC,
+                                    sizeof(monotonic_counter_impl_t));
+        monotonic_counter_t counter;
+        counter.impl_ = counter_impl;
+        return counter;
+    } else {
+        return monotonic_counter_t();
+    }
+}
+
 meter_t registry_t::meter(const std::string& name) {
     if (tree_) {
         auto meter_impl = std::make_shared<meter_impl_t>();
         tree_->add_leaf(name, meter_impl);
+        meter_impl->tracked.track(METER_METRIC, sizeof(meter_impl_t));
         meter_t meter;
         meter.impl_ = meter_impl;
         return meter;
@@ -200,9 +583,33 @@ meter_t registry_t::meter(const std::string& name) {
 }
 
 histogram_t registry_t::histogram(const std::string& name, int min, int max) {
+    return histogram(name, min, max, default_quantiles());
+}
+
+histogram_t registry_t::histogram(const std::string& name, int min, int max,
+                                  const std::vector<double>& quantiles) {
+    if (tree_) {
+        auto hist_impl = std::make_shared<histogram_impl_t>(min, max, quantiles);
+        tree_->add_leaf(name, hist_impl);
+        hist_impl->tracked.track(HISTOGRAM_METRIC, hist_impl->memory_usage());
+        histogram_t hist;
+        hist.impl_ = hist_impl;
+        return hist;
+    } else {
+        return histogram_t();
+    }
+}
+
+histogram_t registry_t::histogram(const std::string& name) {
+    return histogram(name, default_quantiles());
+}
+
+histogram_t registry_t::histogram(const std::string& name,
+                                  const std::vector<double>& quantiles) {
     if (tree_) {
-        auto hist_impl = std::make_shared<histogram_impl_t>(min, max);
+        auto hist_impl = std::make_shared<histogram_impl_t>(quantiles);
         tree_->add_leaf(name, hist_impl);
+        hist_impl->tracked.track(HISTOGRAM_METRIC, hist_impl->memory_usage());
         histogram_t hist;
         hist.impl_ = hist_impl;
         return hist;
@@ -212,9 +619,15 @@ histogram_t registry_t::histogram(const std::string& name, int min, int max) {
 }
 
 timer_t registry_t::timer(const std::string& name) {
+    return timer(name, default_quantiles());
+}
+
+timer_t registry_t::timer(const std::string& name,
+                          const std::vector<double>& quantiles) {
     if (tree_) {
-        auto timer_impl = std::make_shared<timer_impl_t>();
+        auto timer_impl = std::make_shared<timer_impl_t>(quantiles);
         tree_->add_leaf(name, timer_impl);
+        timer_impl->tracked.track(TIMER_METRIC, timer_impl->memory_usage());
         timer_t timer;
         timer.impl_ = timer_impl;
         return timer;
@@ -223,11 +636,125 @@ timer_t registry_t::timer(const std::string& name) {
     }
 }
 
+top_k_t registry_t::top_k(const std::string& name, int k) {
+    if (k <= 0) throw std::invalid_argument("top_k k must be positive, got " + std::to_string(k));
 
-void registry_t::print(tree_printer_t* printer) {
     if (tree_) {
+        auto top_k_impl = std::make_shared<top_k_impl_t>(k);
+        tree_->add_leaf(name, top_k_impl);
+        top_k_impl->tracked.track(TOP_K_METRIC, top_k_impl->memory_usage());
+        top_k_t top_k;
+        top_k.impl_ = top_k_impl;
+        return top_k;
+    } else {
+        return top_k_t();
+    }
+}
+
+cardinality_t registry_t::cardinality(const std::string& name) {
+    if (tree_) {
+        auto cardinality_impl = std::make_shared<cardinality_impl_t>();
+        tree_->add_leaf(name, cardinality_impl);
+        cardinality_impl->tracked.track(CARDINALITY_METRIC, sizeof(cardinality_impl_t));
+        cardinality_t cardinality;
+        cardinality.impl_ = cardinality_impl;
+        return cardinality;
+    } else {
+        return cardinality_t();
+    }
+}
+
+counter_ref_t registry_t::counter_ref(const std::string& name) {
+    counter_ref_t ref;
+    if (tree_) {
+        counter_impl_t* counter_impl = new counter_impl_t();
+        ref.impl_ = add_ref_leaf(tree_.get(), name, counter_impl, COUNTER_METRIC,
+                                 sizeof(counter_impl_t));
+    }
+    return ref;
+}
+
+meter_ref_t registry_t::meter_ref(const std::string& name) {
+    meter_ref_t ref;
+    if (tree_) {
+        meter_impl_t* meter_impl = new meter_impl_t();
+        ref.impl_ = add_ref_leaf(tree_.get(), name, meter_impl, METER_METRIC,
+                                 sizeof(meter_impl_t));
+    }
+    return ref;
+}
+
+histogram_ref_t registry_t::histogram_ref(const std::string& name, int min, int max) {
+    histogram_ref_t ref;
+    if (tree_) {
+        histogram_impl_t* hist_impl = new histogram_impl_t(min, max, default_quantiles());
+        ref.impl_ = add_ref_leaf(tree_.get(), name, hist_impl, HISTOGRAM_METRIC,
+                                 hist_impl->memory_usage());
+    }
+    return ref;
+}
+
+histogram_ref_t registry_t::histogram_ref(const std::string& name) {
+    histogram_ref_t ref;
+    if (tree_) {
+        histogram_impl_t* hist_impl = new histogram_impl_t(default_quantiles());
+        ref.impl_ = add_ref_leaf(tree_.get(), name, hist_impl, HISTOGRAM_METRIC,
+                                 hist_impl->memory_usage());
+    }
+    return ref;
+}
+
+timer_ref_t registry_t::timer_ref(const std::string& name) {
+    timer_ref_t ref;
+    if (tree_) {
+        timer_impl_t* timer_impl = new timer_impl_t(default_quantiles());
+        ref.impl_ = add_ref_leaf(tree_.get(), name, timer_impl, TIMER_METRIC,
+                                 timer_impl->memory_usage());
+    }
+    return ref;
+}
+
+lock_stats_t registry_t::lock_stats(const std::string& name) {
+    if (tree_) {
+        auto lock_stats_impl = std::make_shared<lock_stats_impl_t>();
+        tree_->add_leaf(name, lock_stats_impl);
+        lock_stats_t lock_stats;
+        lock_stats.impl_ = lock_stats_impl;
+        return lock_stats;
+    } else {
+        return lock_stats_t();
+    }
+}
+
+self_metrics_t registry_t::self_metrics(const std::string& name) {
+    if (tree_) {
+        auto self_metrics_impl = std::make_shared<self_metrics_impl_t>();
+        tree_->add_leaf(name, self_metrics_impl);
+        self_metrics_t self_metrics;
+        self_metrics.impl_ = self_metrics_impl;
+        return self_metrics;
+    } else {
+        return self_metrics_t();
+    }
+}
+
+void registry_t::print(tree_printer_t* printer) {
+    if (!tree_) return;
+
+    self_stats_t& stats = self_stats();
+    if (!stats.enabled()) {
         tree_->print(printer);
+        return;
     }
+
+    auto start = std::chrono::steady_clock::now();
+    tree_->print(printer);
+    uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    stats.prints.fetch_add(1, std::memory_order_relaxed);
+    stats.print_ns.fetch_add(elapsed, std::memory_order_relaxed);
+    stats.last_print_ns.store(elapsed, std::memory_order_relaxed);
 }
 
 std::shared_ptr<tree_branch_t> registry_t::ROOT = std::make_shared<tree_branch_t>();
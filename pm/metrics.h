@@ -4,15 +4,23 @@
 #include <memory>
 #include <cstdint>
 #include <functional>
+#include <vector>
 
 #include <pm/time.h>
 
 namespace pm {
 
 struct counter_impl_t;
+struct monotonic_counter_impl_t;
 struct meter_impl_t;
 struct histogram_impl_t;
 struct timer_impl_t;
+struct top_k_impl_t;
+struct cardinality_impl_t;
+struct lock_stats_impl_t;
+struct self_metrics_impl_t;
+
+class hyperloglog_t;
 
 // instantaneous value of integer
 struct counter_t {
@@ -24,9 +32,18 @@ struct counter_t {
     std::shared_ptr<counter_impl_t> impl_;
 };
 
+// total number of events since start, e.g. bytes sent. Cheaper than
+// meter_t, rates are computed by the exporter, see rate_printer_t.
+struct monotonic_counter_t {
+    void inc(uint64_t amount = 1);
+
+    // private
+    std::shared_ptr<monotonic_counter_impl_t> impl_;
+};
+
 // measure rate of events over time e.g. RPS
 struct meter_t {
-    void mark();
+    void mark(int64_t count = 1);
 
     // private
     std::shared_ptr<meter_impl_t> impl_;
@@ -40,6 +57,47 @@ struct histogram_t {
     std::shared_ptr<histogram_impl_t> impl_;
 };
 
+// most frequent keys over the last minute with their rates, e.g. tenants
+// generating most requests. Memory is bounded by k, counts are approximate.
+// Whitespace and control characters in keys are exported as '_'.
+struct top_k_t {
+    void mark(const std::string& key);
+
+    // private
+    std::shared_ptr<top_k_impl_t> impl_;
+};
+
+// number of distinct keys over the last minute, e.g. unique users. Uses
+// HyperLogLog, so memory is a few KB and the error is about 2%.
+struct cardinality_t {
+    void add(uint64_t hash);
+    void add(const std::string& key);
+
+    // sketch of the last complete minute, can be serialized and merged with
+    // sketches from other instances
+    void get(hyperloglog_t* sketch);
+
+    // private
+    std::shared_ptr<cardinality_impl_t> impl_;
+};
+
+// contention of spinlocks inside the library, one subtree per kind of
+// lock with number of contended acquisitions, spins and yields. Counted
+// only while a lock_stats_t handle is alive.
+struct lock_stats_t {
+    // private
+    std::shared_ptr<lock_stats_impl_t> impl_;
+};
+
+// overhead of the library itself: live metrics per type, memory taken
+// by metrics and the tree, registrations, print() duration, bytes
+// produced by graphite_printer_t and time spent waiting for tree locks.
+// Timings, rates and bytes are collected only while a handle is alive.
+struct self_metrics_t {
+    // private
+    std::shared_ptr<self_metrics_impl_t> impl_;
+};
+
 struct timer_t;
 
 class timer_context_t {
@@ -68,13 +126,74 @@ struct timer_t {
     time_point_t start();
     void finish(time_point_t start_time);
 
+    // record duration measured elsewhere
+    void update(int64_t milliseconds);
+
     // private
     std::shared_ptr<timer_impl_t> impl_;
 };
 
+// Handles below are plain pointers to a metric owned by the tree of the
+// registry they were created in, so copying them costs no refcount traffic
+// and calls cost the same as through shared handles. Registering the same
+// name with the same type again returns the same metric, arguments of the
+// first registration apply. Default constructed refs do nothing.
+//
+// Meant for a fixed set of long lived names passed by value into many short
+// lived objects. Nothing tracks copies of refs, so their metrics are freed
+// only with the last branch of the tree, even after the name is registered
+// as another metric (refs then update an unexported metric). Every distinct
+// name ever registered as ref keeps its memory until then, don't derive
+// names from request data. Refs must not be used once the tree is gone.
+
+struct counter_ref_t {
+    counter_ref_t();
+
+    void inc(int64_t amount = 1);
+    void dec(int64_t amount = 1);
+    void set(int64_t value);
+
+    // private
+    counter_impl_t* impl_;
+};
+
+struct meter_ref_t {
+    meter_ref_t();
+
+    void mark(int64_t count = 1);
+
+    // private
+    meter_impl_t* impl_;
+};
+
+struct histogram_ref_t {
+    histogram_ref_t();
+
+    void update(int64_t value);
+
+    // private
+    histogram_impl_t* impl_;
+};
+
+struct timer_ref_t {
+    timer_ref_t();
+
+    time_point_t start();
+    void finish(time_point_t start_time);
+    void update(int64_t milliseconds);
+
+    // private
+    timer_impl_t* impl_;
+};
+
 template <class metric_t>
 class named_t {};
 
+template <class policy_t> class basic_counter_t;
+template <class policy_t> class basic_meter_t;
+template <class policy_t> class basic_histogram_t;
+template <class policy_t> class basic_timer_t;
+
 class tree_branch_t;
 struct tree_printer_t;
 
@@ -89,10 +208,58 @@ public:
     registry_t subtree(const std::string& prefix);
 
     counter_t counter(const std::string& name);
+    monotonic_counter_t monotonic_counter(const std::string& name);
     meter_t meter(const std::string& name);
     histogram_t histogram(const std::string& name, int min, int max);
+    // range grows with observed values
+    histogram_t histogram(const std::string& name);
     timer_t timer(const std::string& name);
 
+    // quantiles to report instead of q50, q80, q90, q95, q99, e.g.
+    // {.5, .99, .999} is reported as q50, q99, q999. Throws
+    // std::invalid_argument if a quantile is outside of (0, 1].
+    histogram_t histogram(const std::string& name, int min, int max,
+                          const std::vector<double>& quantiles);
+    histogram_t histogram(const std::string& name,
+                          const std::vector<double>& quantiles);
+    timer_t timer(const std::string& name, const std::vector<double>& quantiles);
+
+    // throws std::invalid_argument if k isn't positive
+    top_k_t top_k(const std::string& name, int k);
+    cardinality_t cardinality(const std::string& name);
+
+    // trivially copyable handles for long lived names only, see counter_ref_t
+    counter_ref_t counter_ref(const std::string& name);
+    meter_ref_t meter_ref(const std::string& name);
+    histogram_ref_t histogram_ref(const std::string& name, int min, int max);
+    histogram_ref_t histogram_ref(const std::string& name);
+    timer_ref_t timer_ref(const std::string& name);
+
+    // exported while returned handle is alive
+    lock_stats_t lock_stats(const std::string& name);
+    self_metrics_t self_metrics(const std::string& name);
+
+    // metrics with implementation selected at compile time, see pm/policy.h
+    template <class policy_t>
+    basic_counter_t<policy_t> counter(const std::string& name);
+    template <class policy_t>
+    basic_meter_t<policy_t> meter(const std::string& name);
+    template <class policy_t>
+    basic_histogram_t<policy_t> histogram(const std::string& name, int min, int max);
+    template <class policy_t>
+    basic_histogram_t<policy_t> histogram(const std::string& name);
+    template <class policy_t>
+    basic_timer_t<policy_t> timer(const std::string& name);
+    template <class policy_t>
+    basic_histogram_t<policy_t> histogram(const std::string& name, int min, int max,
+                                          const std::vector<double>& quantiles);
+    template <class policy_t>
+    basic_histogram_t<policy_t> histogram(const std::string& name,
+                                          const std::vector<double>& quantiles);
+    template <class policy_t>
+    basic_timer_t<policy_t> timer(const std::string& name,
+                                  const std::vector<double>& quantiles);
+
     template <class metric_t>
     named_t<metric_t> named(const std::string& name);
 
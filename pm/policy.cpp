@@ -0,0 +1,130 @@
+#include <pm/policy.h>
+
+#include <mutex>
+
+namespace pm {
+
+namespace {
+
+// slots of one thread, reused by the next thread once it exits so values
+// it added stay counted
+struct thread_node_t {
+    thread_node_t() : slots(), next(nullptr) {}
+
+    std::atomic<int64_t> slots[thread_local_policy_t::MAX_CELLS];
+
+    // set before the node is published, never changes
+    thread_node_t* next;
+};
+
+struct thread_slots_t {
+    // taken by allocate, release and thread attach and exit, never by sum
+    std::mutex mutex;
+
+    // every node ever attached, never freed, read without the mutex
+    std::atomic<thread_node_t*> nodes;
+
+    // nodes of exited threads
+    std::vector<thread_node_t*> idle;
+
+    std::vector<size_t> free_ids;
+    size_t next_id;
+
+    std::atomic<size_t> overflowed;
+
+    thread_slots_t() : nodes(nullptr), next_id(0), overflowed(0) {}
+};
+
+// never destroyed, threads may exit after static destructors have run
+thread_slots_t& thread_slots() {
+    static thread_slots_t* slots = new thread_slots_t();
+    return *slots;
+}
+
+struct thread_slots_holder_t {
+    thread_slots_holder_t() : node(nullptr), tls(nullptr) {}
+
+    ~thread_slots_holder_t() {
+        if (!node) return;
+
+        thread_slots_t& all = thread_slots();
+        std::lock_guard<std::mutex> guard(all.mutex);
+
+        all.idle.push_back(node);
+        *tls = nullptr;
+    }
+
+    thread_node_t* node;
+    std::atomic<int64_t>** tls;
+};
+
+thread_local thread_slots_holder_t holder;
+
+}  // namespace
+
+size_t thread_local_policy_t::overflowed_cells() {
+    return thread_slots().overflowed.load(std::memory_order_relaxed);
+}
+
+size_t thread_local_policy_t::allocate() {
+    thread_slots_t& all = thread_slots();
+    std::lock_guard<std::mutex> guard(all.mutex);
+
+    if (!all.free_ids.empty()) {
+        size_t id = all.free_ids.back();
+        all.free_ids.pop_back();
+        return id;
+    }
+
+    if (all.next_id < MAX_CELLS) return all.next_id++;
+
+    all.overflowed.fetch_add(1, std::memory_order_relaxed);
+    return MAX_CELLS;
+}
+
+void thread_local_policy_t::release(size_t id) {
+    thread_slots_t& all = thread_slots();
+    if (id >= MAX_CELLS) {
+        all.overflowed.fetch_sub(1, std::memory_order_relaxed);
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(all.mutex);
+
+    for (auto node = all.nodes.load(std::memory_order_relaxed); node;
+         node = node->next) {
+        node->slots[id].store(0, std::memory_order_relaxed);
+    }
+    all.free_ids.push_back(id);
+}
+
+int64_t thread_local_policy_t::sum(size_t id) {
+    if (id >= MAX_CELLS) return 0;
+
+    int64_t sum = 0;
+    for (auto node = thread_slots().nodes.load(std::memory_order_acquire);
+         node; node = node->next) {
+        sum += node->slots[id].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+std::atomic<int64_t>* thread_local_policy_t::attach_thread(
+    std::atomic<int64_t>** tls) {
+    thread_slots_t& all = thread_slots();
+    std::lock_guard<std::mutex> guard(all.mutex);
+
+    if (!all.idle.empty()) {
+        holder.node = all.idle.back();
+        all.idle.pop_back();
+    } else {
+        holder.node = new thread_node_t();
+        holder.node->next = all.nodes.load(std::memory_order_relaxed);
+        all.nodes.store(holder.node, std::memory_order_release);
+    }
+
+    holder.tls = tls;
+    return holder.node->slots;
+}
+
+}  // namespace pm
@@ -0,0 +1,567 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <pm/metrics.h>
+#include <pm/counter.h>
+#include <pm/quantile.h>
+#include <pm/self.h>
+#include <pm/tree.h>
+
+namespace pm {
+
+// Policies select how metric values are accumulated on the hot path.
+//
+// Each policy provides cell_t for scalar values and bucket_t for histogram
+// buckets, both with add() and load(). set() is available only where it
+// makes sense, using it with other policies is a compile error.
+
+// single std::atomic updated with relaxed ordering
+struct relaxed_policy_t {
+    static const bool enabled = true;
+
+    class cell_t {
+    public:
+        cell_t() : value_(0) {}
+
+        void add(int64_t amount) {
+            value_.fetch_add(amount, std::memory_order_relaxed);
+        }
+        void set(int64_t value) {
+            value_.store(value, std::memory_order_relaxed);
+        }
+        int64_t load() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<int64_t> value_;
+    };
+
+    typedef cell_t bucket_t;
+};
+
+// value is split over cache lines, each thread updates one of them. For
+// metrics updated by many threads at once.
+struct striped_policy_t {
+    static const bool enabled = true;
+
+    // striped_counter_t read as signed, two's complement sums wrap the same
+    class cell_t {
+    public:
+        void add(int64_t amount) { counter_.add(uint64_t(amount)); }
+        int64_t load() const { return int64_t(counter_.load()); }
+
+    private:
+        striped_counter_t counter_;
+    };
+
+    // striping histogram buckets costs too much memory, contention is
+    // already spread over buckets
+    typedef relaxed_policy_t::cell_t bucket_t;
+};
+
+// every thread updates its own slot with plain store, load() sums slots of
+// all threads without locking. Cheapest for counters updated by many
+// threads. Each thread takes MAX_CELLS slots, kept for the next thread once
+// it exits. Cells allocated beyond MAX_CELLS fall back to a shared relaxed
+// atomic, see overflowed_cells().
+struct thread_local_policy_t {
+    static const bool enabled = true;
+    static const size_t MAX_CELLS = 1024;
+
+    class cell_t {
+    public:
+        cell_t() : id_(allocate()), overflow_(0) {}
+        ~cell_t() { release(id_); }
+
+        cell_t(const cell_t&) = delete;
+        cell_t& operator = (const cell_t&) = delete;
+
+        // updated through the shared atomic
+        bool overflowed() const { return id_ >= MAX_CELLS; }
+
+        void add(int64_t amount) {
+            if (id_ < MAX_CELLS) {
+                std::atomic<int64_t>& slot = slots()[id_];
+                slot.store(slot.load(std::memory_order_relaxed) + amount,
+                           std::memory_order_relaxed);
+            } else {
+                overflow_.fetch_add(amount, std::memory_order_relaxed);
+            }
+        }
+
+        int64_t load() const {
+            return overflow_.load(std::memory_order_relaxed) + sum(id_);
+        }
+
+    private:
+        size_t id_;
+        std::atomic<int64_t> overflow_;
+    };
+
+    // cells of one histogram would exhaust MAX_CELLS
+    typedef relaxed_policy_t::cell_t bucket_t;
+
+    static std::atomic<int64_t>* slots() {
+        static thread_local std::atomic<int64_t>* slots = nullptr;
+
+        if (!slots) slots = attach_thread(&slots);
+        return slots;
+    }
+
+    // live cells updated through the shared atomic
+    static size_t overflowed_cells();
+
+    // return MAX_CELLS when all cells are taken
+    static size_t allocate();
+    static void release(size_t id);
+    static int64_t sum(size_t id);
+
+    static std::atomic<int64_t>* attach_thread(std::atomic<int64_t>** slots);
+};
+
+// no synchronization between writers, for metrics updated by a single
+// thread. Still safe to read from another thread.
+struct plain_policy_t {
+    static const bool enabled = true;
+
+    class cell_t {
+    public:
+        cell_t() : value_(0) {}
+
+        void add(int64_t amount) {
+            value_.store(value_.load(std::memory_order_relaxed) + amount,
+                         std::memory_order_relaxed);
+        }
+        void set(int64_t value) {
+            value_.store(value, std::memory_order_relaxed);
+        }
+        int64_t load() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<int64_t> value_;
+    };
+
+    typedef cell_t bucket_t;
+};
+
+// compiled out, metrics are not registered
+struct noop_policy_t {
+    static const bool enabled = false;
+
+    struct cell_t {
+        void add(int64_t) {}
+        void set(int64_t) {}
+        int64_t load() const { return 0; }
+    };
+
+    typedef cell_t bucket_t;
+};
+
+template <class policy_t>
+struct basic_counter_impl_t : public tree_leaf_t {
+    virtual void print(tree_printer_t* printer) { printer->value(value.load()); }
+
+    typename policy_t::cell_t value;
+    self_tracked_t tracked;
+};
+
+// rates are updated from the number of events when metric is printed.
+// one_sec is the average rate since the previous print at least a second
+// ago, longer rates decay the count marked at print time.
+template <class policy_t>
+struct basic_meter_impl_t : public tree_leaf_t {
+    basic_meter_impl_t()
+        : printed_count(0),
+          rate_count(0),
+          rate_time(std::chrono::system_clock::now()),
+          one_sec(0),
+          one_min(std::chrono::seconds(60)),
+          quarter_hour(std::chrono::seconds(15 * 60)),
+          one_hour(std::chrono::seconds(60 * 60)) {}
+
+    virtual void print(tree_printer_t* printer) {
+        auto now = printer->now();
+
+        int64_t current = count.load();
+        if (current != printed_count) {
+            one_min.mark(now, current - printed_count);
+            quarter_hour.mark(now, current - printed_count);
+            one_hour.mark(now, current - printed_count);
+            printed_count = current;
+        }
+
+        double elapsed = std::chrono::duration<double>(now - rate_time).count();
+        if (elapsed >= 1) {
+            one_sec = (current - rate_count) / elapsed;
+            rate_count = current;
+            rate_time = now;
+        }
+
+        printer->start_node();
+
+        printer->child("one_sec");
+        printer->value(one_sec);
+
+        printer->child("one_min");
+        printer->value(one_min.value(now) / 60.);
+
+        printer->child("quarter_hour");
+        printer->value(quarter_hour.value(now) / 15. / 60.);
+
+        printer->child("one_hour");
+        printer->value(one_hour.value(now) / 60. / 60.);
+
+        printer->end_node();
+    }
+
+    typename policy_t::cell_t count;
+    int64_t printed_count;
+
+    int64_t rate_count;
+    time_point_t rate_time;
+    double one_sec;
+
+    decaying_counter_t one_min, quarter_hour, one_hour;
+    self_tracked_t tracked;
+};
+
+// values are counted in policy buckets and moved into a decaying histogram
+// and a summary when metric is printed. Exports the same children as
+// histogram_t, count, sum, underflow and overflow are exact, min, max,
+// mean and stddev are computed from the middles of buckets.
+template <class policy_t>
+struct basic_histogram_impl_t : public tree_leaf_t {
+    static const int N_LINEAR_BUCKETS = 1000;
+
+    basic_histogram_impl_t(int min, int max, const std::vector<double>& quantiles)
+        : mapping(min, max, N_LINEAR_BUCKETS),
+          buckets(N_LINEAR_BUCKETS),
+          printed_buckets(N_LINEAR_BUCKETS),
+          linear(new histogram_counter_t(std::chrono::minutes(5), mapping)),
+          summary(std::chrono::minutes(1)),
+          quantiles(quantiles) {}
+
+    // range grows with observed values
+    explicit basic_histogram_impl_t(const std::vector<double>& quantiles)
+        : mapping(0, 1, 1),
+          buckets(auto_histogram_counter_t::N_BUCKETS),
+          printed_buckets(auto_histogram_counter_t::N_BUCKETS),
+          automatic(new auto_histogram_counter_t(std::chrono::minutes(5))),
+          summary(std::chrono::minutes(1)),
+          quantiles(quantiles) {}
+
+    virtual void print(tree_printer_t* printer) {
+        auto now = printer->now();
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            int64_t current = buckets[i].load();
+            if (current == printed_buckets[i]) continue;
+
+            int64_t count = current - printed_buckets[i];
+            printed_buckets[i] = current;
+            if (linear) {
+                linear->update_bucket(now, i, count);
+                summary.update(now, (mapping.unmap(i) + mapping.unmap(i + 1)) / 2, count);
+            } else {
+                automatic->update_bucket(now, i, count);
+                summary.update(now, auto_histogram_counter_t::bucket_value(i), count);
+            }
+        }
+
+        std::vector<double> qvalues;
+        if (linear) {
+            linear->get_quantiles(now, quantiles.values, &qvalues);
+        } else {
+            automatic->get_quantiles(now, quantiles.values, &qvalues);
+        }
+
+        summary_counter_t::summary_t window;
+        summary.get(now, &window);
+
+        printer->start_node();
+        for (size_t i = 0; i < quantiles.values.size(); ++i) {
+            printer->child(quantiles.names[i]);
+            printer->value(qvalues[i]);
+        }
+        printer->child("count");
+        printer->value(summary.count());
+        printer->child("sum");
+        printer->value(sum.load());
+        printer->child("min");
+        printer->value(window.min);
+        printer->child("max");
+        printer->value(window.max);
+        printer->child("mean");
+        printer->value(window.mean);
+        printer->child("stddev");
+        printer->value(window.stddev);
+        printer->child("underflow");
+        printer->value(underflow.load());
+        printer->child("overflow");
+        printer->value(overflow.load());
+        printer->end_node();
+    }
+
+    void update(int64_t value) {
+        int bucket;
+        if (linear) {
+            if (value < mapping.min()) {
+                underflow.add(1);
+            } else if (value > mapping.max()) {
+                overflow.add(1);
+            }
+            bucket = mapping.map(value);
+        } else {
+            if (value < 0) underflow.add(1);
+            bucket = auto_histogram_counter_t::bucket_index(value);
+            if (bucket == auto_histogram_counter_t::OVERFLOW_BUCKET) overflow.add(1);
+        }
+
+        buckets[bucket].add(1);
+        sum.add(value);
+    }
+
+    size_t memory_usage() const {
+        size_t bytes = sizeof(*this) +
+                       buckets.size() * (sizeof(buckets[0]) + sizeof(int64_t));
+        if (linear) {
+            bytes += sizeof(histogram_counter_t) +
+                     N_LINEAR_BUCKETS * sizeof(decaying_counter_t);
+        }
+        if (automatic) bytes += automatic->memory_usage();
+        return bytes;
+    }
+
+    // unused by automatic histograms
+    linear_mapping_t mapping;
+
+    std::vector<typename policy_t::bucket_t> buckets;
+    std::vector<int64_t> printed_buckets;
+    typename policy_t::cell_t sum;
+    typename policy_t::bucket_t underflow, overflow;
+
+    // exactly one of them is set
+    std::unique_ptr<histogram_counter_t> linear;
+    std::unique_ptr<auto_histogram_counter_t> automatic;
+
+    // min, max, mean and stddev are over the previous minute
+    summary_counter_t summary;
+    quantiles_t quantiles;
+
+    self_tracked_t tracked;
+};
+
+template <class policy_t>
+struct basic_timer_impl_t : public tree_leaf_t {
+    explicit basic_timer_impl_t(const std::vector<double>& quantiles)
+        : timings(quantiles) {}
+
+    virtual void print(tree_printer_t* printer) {
+        printer->start_node();
+        printer->child("active");
+        printer->value(active_count.load());
+
+        printer->child("rate");
+        rate.print(printer);
+
+        printer->child("timings");
+        timings.print(printer);
+        printer->end_node();
+    }
+
+    size_t memory_usage() const {
+        return sizeof(*this) - sizeof(timings) + timings.memory_usage();
+    }
+
+    typename policy_t::cell_t active_count;
+    basic_meter_impl_t<policy_t> rate;
+    basic_histogram_impl_t<policy_t> timings;
+    self_tracked_t tracked;
+};
+
+// Same interface as counter_t, meter_t, histogram_t and timer_t, but every
+// call is inlined and there is no null check: default constructed metric
+// writes into a private unregistered impl. Histogram and timer calls of
+// disabled policies are empty, they don't compute buckets nor read clock.
+
+template <class policy_t>
+class basic_counter_t {
+public:
+    basic_counter_t() : impl_(sink()) {}
+
+    void inc(int64_t amount = 1) { impl_->value.add(amount); }
+    void dec(int64_t amount = 1) { impl_->value.add(-amount); }
+    void set(int64_t value) { impl_->value.set(value); }
+
+    // private
+    std::shared_ptr<basic_counter_impl_t<policy_t>> impl_;
+
+private:
+    static const std::shared_ptr<basic_counter_impl_t<policy_t>>& sink() {
+        static auto sink = std::make_shared<basic_counter_impl_t<policy_t>>();
+        return sink;
+    }
+};
+
+template <class policy_t>
+class basic_meter_t {
+public:
+    basic_meter_t() : impl_(sink()) {}
+
+    void mark() { impl_->count.add(1); }
+
+    // private
+    std::shared_ptr<basic_meter_impl_t<policy_t>> impl_;
+
+private:
+    static const std::shared_ptr<basic_meter_impl_t<policy_t>>& sink() {
+        static auto sink = std::make_shared<basic_meter_impl_t<policy_t>>();
+        return sink;
+    }
+};
+
+template <class policy_t>
+class basic_histogram_t {
+public:
+    basic_histogram_t() : impl_(sink()) {}
+
+    void update(int64_t value) {
+        if (policy_t::enabled) impl_->update(value);
+    }
+
+    // private
+    std::shared_ptr<basic_histogram_impl_t<policy_t>> impl_;
+
+private:
+    static const std::shared_ptr<basic_histogram_impl_t<policy_t>>& sink() {
+        static auto sink =
+            std::make_shared<basic_histogram_impl_t<policy_t>>(default_quantiles());
+        return sink;
+    }
+};
+
+template <class policy_t>
+class basic_timer_t {
+public:
+    basic_timer_t() : impl_(sink()) {}
+
+    time_point_t start() {
+        if (!policy_t::enabled) return time_point_t();
+
+        impl_->active_count.add(1);
+        impl_->rate.count.add(1);
+        return std::chrono::system_clock::now();
+    }
+
+    void finish(time_point_t start_time) {
+        if (!policy_t::enabled) return;
+
+        impl_->active_count.add(-1);
+
+        auto now = time_point_t(std::chrono::system_clock::now());
+        impl_->timings.update(
+            std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time)
+                .count());
+    }
+
+    // record duration measured elsewhere
+    void update(int64_t milliseconds) {
+        if (!policy_t::enabled) return;
+
+        impl_->rate.count.add(1);
+        impl_->timings.update(milliseconds);
+    }
+
+    // private
+    std::shared_ptr<basic_timer_impl_t<policy_t>> impl_;
+
+private:
+    static const std::shared_ptr<basic_timer_impl_t<policy_t>>& sink() {
+        static auto sink =
+            std::make_shared<basic_timer_impl_t<policy_t>>(default_quantiles());
+        return sink;
+    }
+};
+
+template <class policy_t>
+basic_counter_t<policy_t> registry_t::counter(const std::string& name) {
+    basic_counter_t<policy_t> counter;
+    if (tree_ && policy_t::enabled) {
+        counter.impl_ = std::make_shared<basic_counter_impl_t<policy_t>>();
+        tree_->add_leaf(name, counter.impl_);
+        counter.impl_->tracked.track(COUNTER_METRIC,
+                                     sizeof(basic_counter_impl_t<policy_t>));
+    }
+    return counter;
+}
+
+template <class policy_t>
+basic_meter_t<policy_t> registry_t::meter(const std::string& name) {
+    basic_meter_t<policy_t> meter;
+    if (tree_ && policy_t::enabled) {
+        meter.impl_ = std::make_shared<basic_meter_impl_t<policy_t>>();
+        tree_->add_leaf(name, meter.impl_);
+        meter.impl_->tracked.track(METER_METRIC,
+                                   sizeof(basic_meter_impl_t<policy_t>));
+    }
+    return meter;
+}
+
+template <class policy_t>
+basic_histogram_t<policy_t> registry_t::histogram(const std::string& name,
+                                                  int min, int max) {
+    return histogram<policy_t>(name, min, max, default_quantiles());
+}
+
+template <class policy_t>
+basic_histogram_t<policy_t> registry_t::histogram(
+    const std::string& name, int min, int max,
+    const std::vector<double>& quantiles) {
+    basic_histogram_t<policy_t> hist;
+    if (tree_ && policy_t::enabled) {
+        hist.impl_ = std::make_shared<basic_histogram_impl_t<policy_t>>(
+            min, max, quantiles);
+        tree_->add_leaf(name, hist.impl_);
+        hist.impl_->tracked.track(HISTOGRAM_METRIC, hist.impl_->memory_usage());
+    }
+    return hist;
+}
+
+template <class policy_t>
+basic_histogram_t<policy_t> registry_t::histogram(const std::string& name) {
+    return histogram<policy_t>(name, default_quantiles());
+}
+
+template <class policy_t>
+basic_histogram_t<policy_t> registry_t::histogram(
+    const std::string& name, const std::vector<double>& quantiles) {
+    basic_histogram_t<policy_t> hist;
+    if (tree_ && policy_t::enabled) {
+        hist.impl_ =
+            std::make_shared<basic_histogram_impl_t<policy_t>>(quantiles);
+        tree_->add_leaf(name, hist.impl_);
+        hist.impl_->tracked.track(HISTOGRAM_METRIC, hist.impl_->memory_usage());
+    }
+    return hist;
+}
+
+template <class policy_t>
+basic_timer_t<policy_t> registry_t::timer(const std::string& name) {
+    return timer<policy_t>(name, default_quantiles());
+}
+
+template <class policy_t>
+basic_timer_t<policy_t> registry_t::timer(const std::string& name,
+                                          const std::vector<double>& quantiles) {
+    basic_timer_t<policy_t> timer;
+    if (tree_ && policy_t::enabled) {
+        timer.impl_ = std::make_shared<basic_timer_impl_t<policy_t>>(quantiles);
+        tree_->add_leaf(name, timer.impl_);
+        timer.impl_->tracked.track(TIMER_METRIC, timer.impl_->memory_usage());
+    }
+    return timer;
+}
+
+}  // namespace pm
@@ -0,0 +1,46 @@
+#include <pm/quantile.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace pm {
+
+// shortest decimal that reads back as the same double
+static std::string quantile_name(double quantile) {
+    if (quantile == 1) return "q100";
+
+    char buffer[32];
+    for (int precision = 2; precision <= 17; ++precision) {
+        snprintf(buffer, sizeof(buffer), "%.*f", precision, quantile);
+        if (strtod(buffer, nullptr) == quantile) break;
+    }
+
+    std::string digits(buffer + 2);
+    while (digits.size() > 2 && digits.back() == '0') digits.pop_back();
+    return "q" + digits;
+}
+
+quantiles_t::quantiles_t(const std::vector<double>& quantiles)
+    : values(quantiles) {
+    for (double quantile : values) {
+        // also rejects NaN
+        if (!(quantile > 0 && quantile <= 1)) {
+            throw std::invalid_argument("quantile " + std::to_string(quantile) +
+                                        " is outside of (0, 1]");
+        }
+    }
+
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+
+    for (double quantile : values) names.push_back(quantile_name(quantile));
+}
+
+const std::vector<double>& default_quantiles() {
+    static const std::vector<double> quantiles = { .5, .8, .9, .95, .99 };
+    return quantiles;
+}
+
+}  // namespace pm
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace pm {
+
+// quantiles reported by a histogram with their child names, 0.5 -> "q50",
+// 0.999 -> "q999". Values are sorted and duplicates dropped, names have as
+// many digits as needed to tell values apart.
+//
+// Throws std::invalid_argument if a value is outside of (0, 1].
+struct quantiles_t {
+    explicit quantiles_t(const std::vector<double>& values);
+
+    std::vector<double> values;
+    std::vector<std::string> names;
+};
+
+// q50, q80, q90, q95 and q99
+const std::vector<double>& default_quantiles();
+
+}  // namespace pm
@@ -0,0 +1,120 @@
+#include <pm/rate.h>
+
+namespace pm {
+
+rate_printer_t::rate_printer_t(tree_printer_t* printer)
+    : printer_(printer),
+      depth_(0),
+      has_time_(false),
+      has_captured_time_(false),
+      pass_(0) {}
+
+void rate_printer_t::reset(tree_printer_t* printer) {
+    printer_ = printer;
+    depth_ = 0;
+    key_.clear();
+    key_sizes_.clear();
+}
+
+void rate_printer_t::start_pass() {
+    for (auto it = previous_.begin(); it != previous_.end();) {
+        if (it->second.pass != pass_) {
+            it = previous_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    time_ = captured_time_;
+    has_time_ = has_captured_time_;
+    has_captured_time_ = false;
+    ++pass_;
+}
+
+void rate_printer_t::start_node() {
+    if (depth_++ == 0) start_pass();
+    printer_->start_node();
+}
+
+void rate_printer_t::end_node() {
+    printer_->end_node();
+    if (depth_ > 0) --depth_;
+    pop_key();
+}
+
+void rate_printer_t::child(const std::string& name) {
+    printer_->child(name);
+
+    key_sizes_.push_back(key_.size());
+    key_.append(name);
+    key_.push_back('\0');
+}
+
+void rate_printer_t::value(double value) {
+    printer_->value(value);
+    pop_key();
+}
+
+void rate_printer_t::value(int64_t value) {
+    printer_->value(value);
+    pop_key();
+}
+
+void rate_printer_t::value(uint64_t value) {
+    printer_->value(value);
+    pop_key();
+}
+
+void rate_printer_t::monotonic(uint64_t value) {
+    if (!has_time_) {
+        time_ = printer_->now();
+        has_time_ = true;
+    }
+
+    uint64_t delta = 0;
+    double seconds = 0;
+
+    auto it = previous_.find(key_);
+    if (it == previous_.end()) {
+        previous_.emplace(key_, previous_t{value, time_, pass_});
+    } else {
+        previous_t& previous = it->second;
+
+        // unsigned subtraction gives the right delta across wraparound
+        delta = value - previous.value;
+        if (value < previous.value && delta >= MAX_WRAPPED_DELTA) delta = value;
+
+        seconds = std::chrono::duration<double>(time_ - previous.time).count();
+        previous = previous_t{value, time_, pass_};
+    }
+
+    printer_->start_node();
+    printer_->child("total");
+    printer_->value(value);
+    printer_->child("delta");
+    printer_->value(delta);
+    printer_->child("rate");
+    printer_->value(seconds > 0 ? delta / seconds : 0.);
+    printer_->end_node();
+
+    pop_key();
+}
+
+time_point_t rate_printer_t::now() { return printer_->now(); }
+
+void rate_printer_t::captured_at(time_point_t time) {
+    captured_time_ = time;
+    has_captured_time_ = true;
+    printer_->captured_at(time);
+}
+
+std::string rate_printer_t::result() const { return printer_->result(); }
+
+void rate_printer_t::pop_key() {
+    if (!key_sizes_.empty()) {
+        key_.resize(key_sizes_.back());
+        key_sizes_.pop_back();
+    }
+}
+
+}  // namespace pm
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <pm/tree.h>
+
+namespace pm {
+
+// forwards the tree to another printer, replacing every monotonic value
+// with a node of
+//   total - value as reported
+//   delta - increase since the previous print
+//   rate  - delta per second
+//
+// Previous values are kept per path, so each consumer (e.g. each graphite
+// server) needs its own rate_printer_t living across prints:
+//
+//   rate_printer_t rates;
+//   ...
+//   graphite_printer_t graphite("prefix");
+//   rates.reset(&graphite);
+//   registry.print(&rates);
+//
+// Every start_node() of the root begins a new pass and forgets paths
+// missing in the previous pass, so a printer given to the constructor can
+// be reused as well. Pass time is the capture time of a replayed source
+// (snapshot_t, spool_reader_t), otherwise now() of the printer on the
+// first monotonic value.
+//
+// A total smaller than the previous one is a wraparound if the modular
+// increase is small, otherwise the counter was restarted and delta is the
+// new total. Delta of the first print of a path is 0.
+class rate_printer_t : public tree_printer_t {
+public:
+    // increases this large are taken for restarts of the counter
+    static const uint64_t MAX_WRAPPED_DELTA = uint64_t(1) << 62;
+
+    explicit rate_printer_t(tree_printer_t* printer = nullptr);
+
+    // prints next passes to printer
+    void reset(tree_printer_t* printer);
+
+    virtual void start_node();
+    virtual void end_node();
+
+    virtual void child(const std::string& name);
+    virtual void value(double value);
+    virtual void value(int64_t value);
+    virtual void value(uint64_t value);
+    virtual void monotonic(uint64_t value);
+
+    virtual time_point_t now();
+    virtual void captured_at(time_point_t time);
+
+    virtual std::string result() const;
+
+private:
+    struct previous_t {
+        uint64_t value;
+        time_point_t time;
+        uint64_t pass;
+    };
+
+    tree_printer_t* printer_;
+    // nodes open in the current pass, root included
+    size_t depth_;
+
+    // time of the current pass, taken on the first monotonic value
+    time_point_t time_;
+    bool has_time_;
+
+    // capture time of the source of the next pass
+    time_point_t captured_time_;
+    bool has_captured_time_;
+
+    uint64_t pass_;
+    std::unordered_map<std::string, previous_t> previous_;
+
+    std::string key_;
+    std::vector<size_t> key_sizes_;
+
+    void start_pass();
+    void pop_key();
+};
+
+}  // namespace pm
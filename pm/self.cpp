@@ -0,0 +1,43 @@
+#include <pm/self.h>
+
+namespace pm {
+
+self_stats_t::self_stats_t()
+    : users(0),
+      impl_bytes(0),
+      tree_bytes(0),
+      registrations(0),
+      prints(0),
+      print_ns(0),
+      last_print_ns(0),
+      graphite_bytes(0),
+      tree_lock_waits(0),
+      tree_lock_wait_ns(0) {
+    for (auto& n : live) n.store(0, std::memory_order_relaxed);
+}
+
+// never destroyed, metrics may outlive static destructors
+self_stats_t& self_stats() {
+    static self_stats_t* stats = new self_stats_t();
+    return *stats;
+}
+
+void self_tracked_t::track(metric_type_t type, size_t bytes) {
+    self_stats_t& stats = self_stats();
+
+    type_ = type;
+    bytes_ = bytes;
+    stats.live[type].fetch_add(1, std::memory_order_relaxed);
+    stats.impl_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    stats.registrations.fetch_add(1, std::memory_order_relaxed);
+}
+
+self_tracked_t::~self_tracked_t() {
+    if (type_ == N_METRIC_TYPES) return;
+
+    self_stats_t& stats = self_stats();
+    stats.live[type_].fetch_sub(1, std::memory_order_relaxed);
+    stats.impl_bytes.fetch_sub(bytes_, std::memory_order_relaxed);
+}
+
+}  // namespace pm
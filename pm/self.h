@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <pm/counter.h>
+
+namespace pm {
+
+enum metric_type_t {
+    COUNTER_METRIC,
+    MONOTONIC_COUNTER_METRIC,
+    METER_METRIC,
+    HISTOGRAM_METRIC,
+    TIMER_METRIC,
+    TOP_K_METRIC,
+    CARDINALITY_METRIC,
+    N_METRIC_TYPES
+};
+
+// overhead of the library itself, reported by registry_t::self_metrics().
+// Only registration, printing and contended tree locks update it, all
+// updates are relaxed and take no locks. Live metrics, memory and
+// registration count are always kept, timings and bytes only while
+// enabled().
+struct self_stats_t {
+    self_stats_t();
+
+    // while a self_metrics_t handle is alive
+    bool enabled() const { return users.load(std::memory_order_relaxed) > 0; }
+
+    std::atomic<int> users;
+
+    std::atomic<int64_t> live[N_METRIC_TYPES];
+    std::atomic<int64_t> impl_bytes, tree_bytes;
+
+    std::atomic<uint64_t> registrations;
+
+    std::atomic<uint64_t> prints, print_ns, last_print_ns;
+    std::atomic<uint64_t> graphite_bytes;
+
+    std::atomic<uint64_t> tree_lock_waits, tree_lock_wait_ns;
+};
+
+self_stats_t& self_stats();
+
+// member of metric impls, counts the impl as live metric of given type
+// once it is registered. Impls nested in other impls stay untracked.
+class self_tracked_t {
+public:
+    self_tracked_t() : type_(N_METRIC_TYPES), bytes_(0) {}
+    ~self_tracked_t();
+
+    self_tracked_t(const self_tracked_t&) = delete;
+    self_tracked_t& operator = (const self_tracked_t&) = delete;
+
+    void track(metric_type_t type, size_t bytes);
+
+private:
+    metric_type_t type_;
+    size_t bytes_;
+};
+
+}  // namespace pm
@@ -0,0 +1,350 @@
+#include <pm/shared.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <system_error>
+
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <pm/counter.h>
+#include <pm/tree.h>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "shared metrics require address-free 64 bit atomics");
+
+namespace pm {
+
+static const uint64_t SHARED_MAGIC = 0x706d736872656731ULL;
+static const size_t CACHE_LINE = 64;
+static const size_t MAX_NAME_SIZE = 232;
+static const int N_BUCKETS = 1000;
+
+static std::vector<double> QUANTILES = { .5, .8, .9, .95, .99 };
+
+enum shared_kind_t : uint32_t {
+    KIND_NONE = 0,
+    KIND_COUNTER = 1,
+    KIND_METER = 2,
+    KIND_HISTOGRAM = 3
+};
+
+// slot state is (pid << 2) | tag, so claiming a slot and recording its
+// owner happens in a single CAS
+static const uint64_t STATE_EMPTY = 0;
+static const uint64_t STATE_BUSY = 1;
+static const uint64_t STATE_READY = 2;
+
+// publish() takes microseconds, a slot busy for longer than this was
+// claimed by a process that died and whose pid now belongs to another one
+static const std::chrono::seconds MAX_BUSY_TIME(1);
+
+struct shared_region_t {
+    uint64_t magic;
+    uint64_t max_metrics;
+    uint64_t arena_size;
+    std::atomic<uint64_t> arena_used;
+};
+
+struct shared_slot_t {
+    std::atomic<uint64_t> state;
+    uint32_t kind;
+    uint32_t hash;
+    uint64_t offset;
+    char name[MAX_NAME_SIZE];
+};
+
+static_assert(sizeof(shared_slot_t) == 256, "unexpected slot size");
+
+struct shared_histogram_data_t {
+    shared_histogram_data_t(int min, int max) : mapping(min, max, N_BUCKETS) {}
+
+    std::atomic<uint64_t>* buckets() {
+        return reinterpret_cast<std::atomic<uint64_t>*>(this + 1);
+    }
+
+    linear_mapping_t mapping;
+    uint64_t padding_;
+};
+
+static size_t align(size_t size) {
+    return (size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+}
+
+static uint32_t hash_name(const std::string& name) {
+    uint32_t hash = 2166136261u;
+    for (char c : name) {
+        hash ^= uint8_t(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool process_alive(pid_t pid) {
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+void shared_counter_t::inc(int64_t amount) {
+    if (value_) value_->fetch_add(amount, std::memory_order_relaxed);
+}
+
+void shared_counter_t::dec(int64_t amount) {
+    if (value_) value_->fetch_sub(amount, std::memory_order_relaxed);
+}
+
+void shared_counter_t::set(int64_t value) {
+    if (value_) value_->store(value, std::memory_order_relaxed);
+}
+
+void shared_meter_t::mark() {
+    if (count_) count_->fetch_add(1, std::memory_order_relaxed);
+}
+
+void shared_histogram_t::update(int64_t value) {
+    if (data_) {
+        data_->buckets()[data_->mapping.map(value)].fetch_add(
+            1, std::memory_order_relaxed);
+    }
+}
+
+shared_registry_t::shared_registry_t(size_t max_metrics, size_t arena_size)
+    : region_(nullptr),
+      region_size_(align(sizeof(shared_region_t)) +
+                   max_metrics * sizeof(shared_slot_t) + align(arena_size)),
+      previous_print_(std::chrono::system_clock::now()) {
+    void* memory = mmap(nullptr, region_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw std::system_error(errno, std::system_category(),
+                                "mmap of shared registry failed");
+    }
+
+    // anonymous mapping is zero filled, so every slot starts empty
+    region_ = static_cast<shared_region_t*>(memory);
+    region_->magic = SHARED_MAGIC;
+    region_->max_metrics = max_metrics;
+    region_->arena_size = align(arena_size);
+}
+
+shared_registry_t::~shared_registry_t() { munmap(region_, region_size_); }
+
+shared_slot_t* shared_registry_t::slot(size_t index) {
+    char* slots = reinterpret_cast<char*>(region_) +
+                  align(sizeof(shared_region_t));
+    return reinterpret_cast<shared_slot_t*>(slots) + index;
+}
+
+void* shared_registry_t::payload(shared_slot_t* s) {
+    char* arena = reinterpret_cast<char*>(slot(region_->max_metrics));
+    return arena + s->offset;
+}
+
+void shared_registry_t::publish(shared_slot_t* s, const std::string& name,
+                                uint32_t kind, uint32_t hash,
+                                size_t payload_size,
+                                const std::function<void(void*)>& init) {
+    memcpy(s->name, name.c_str(), name.size() + 1);
+    s->hash = hash;
+    s->kind = KIND_NONE;
+
+    // memory leaked by a process that died before publishing is never reused
+    uint64_t size = align(payload_size);
+    uint64_t offset = region_->arena_used.fetch_add(size);
+    if (offset + size <= region_->arena_size) {
+        s->offset = offset;
+        s->kind = kind;
+        init(payload(s));
+    }
+
+    s->state.store(STATE_READY, std::memory_order_release);
+}
+
+shared_slot_t* shared_registry_t::find_or_create(
+    const std::string& name, uint32_t kind, size_t payload_size,
+    const std::function<void(void*)>& init) {
+    if (name.size() >= MAX_NAME_SIZE) return nullptr;
+
+    const uint64_t busy = (uint64_t(getpid()) << 2) | STATE_BUSY;
+    const uint32_t hash = hash_name(name);
+
+    for (size_t i = 0; i < region_->max_metrics; ++i) {
+        shared_slot_t* s = slot((hash + i) % region_->max_metrics);
+
+        uint64_t state = s->state.load(std::memory_order_acquire);
+        uint64_t waited_state = STATE_EMPTY;
+        std::chrono::steady_clock::time_point busy_since;
+
+        while ((state & 3) != STATE_READY) {
+            if (state != waited_state) {
+                waited_state = state;
+                busy_since = std::chrono::steady_clock::now();
+            }
+
+            if (state == STATE_EMPTY ||
+                !process_alive(pid_t(state >> 2)) ||
+                std::chrono::steady_clock::now() - busy_since > MAX_BUSY_TIME) {
+                // empty slot or slot abandoned by a crashed process
+                if (s->state.compare_exchange_strong(state, busy)) {
+                    publish(s, name, kind, hash, payload_size, init);
+                    break;
+                }
+            } else {
+                sched_yield();
+                state = s->state.load(std::memory_order_acquire);
+            }
+        }
+
+        if (s->hash == hash && strcmp(s->name, name.c_str()) == 0) {
+            return s->kind == kind ? s : nullptr;
+        }
+    }
+
+    return nullptr;
+}
+
+shared_counter_t shared_registry_t::counter(const std::string& name) {
+    shared_counter_t counter;
+    shared_slot_t* s = find_or_create(
+        name, KIND_COUNTER, sizeof(std::atomic<int64_t>), [](void*) {});
+    if (s) {
+        counter.value_ = static_cast<std::atomic<int64_t>*>(payload(s));
+    }
+    return counter;
+}
+
+shared_meter_t shared_registry_t::meter(const std::string& name) {
+    shared_meter_t meter;
+    shared_slot_t* s = find_or_create(
+        name, KIND_METER, sizeof(std::atomic<uint64_t>), [](void*) {});
+    if (s) {
+        meter.count_ = static_cast<std::atomic<uint64_t>*>(payload(s));
+    }
+    return meter;
+}
+
+shared_histogram_t shared_registry_t::histogram(const std::string& name,
+                                                int min, int max) {
+    shared_histogram_t hist;
+    shared_slot_t* s = find_or_create(
+        name, KIND_HISTOGRAM,
+        sizeof(shared_histogram_data_t) +
+            N_BUCKETS * sizeof(std::atomic<uint64_t>),
+        [min, max](void* p) { new (p) shared_histogram_data_t(min, max); });
+    if (s) {
+        hist.data_ = static_cast<shared_histogram_data_t*>(payload(s));
+    }
+    return hist;
+}
+
+static std::vector<std::string> split_name(const char* name) {
+    std::vector<std::string> path(1);
+    for (const char* c = name; *c; ++c) {
+        if (*c == '.') {
+            path.emplace_back();
+        } else {
+            path.back().push_back(*c);
+        }
+    }
+    return path;
+}
+
+static void get_quantiles(linear_mapping_t mapping,
+                          const std::vector<uint64_t>& histogram,
+                          std::vector<double>* quantiles_value) {
+    quantiles_value->assign(QUANTILES.size(), mapping.unmap(0));
+
+    uint64_t total = 0;
+    for (uint64_t count : histogram) total += count;
+    if (total == 0) return;
+
+    double sum = 0.0;
+    size_t q = 0;
+    for (size_t i = 0; i < histogram.size() && q < QUANTILES.size(); ++i) {
+        while (q < QUANTILES.size() && sum >= QUANTILES[q] * total) {
+            (*quantiles_value)[q] = mapping.unmap(i);
+            ++q;
+        }
+
+        sum += histogram[i];
+    }
+
+    for (; q < QUANTILES.size(); ++q) {
+        (*quantiles_value)[q] = mapping.unmap(mapping.n_buckets());
+    }
+}
+
+void shared_registry_t::print(tree_printer_t* printer) {
+    auto now = std::chrono::system_clock::now();
+    double elapsed = duration_t(now - previous_print_).count();
+    previous_print_ = now;
+
+    std::vector<std::pair<std::vector<std::string>, size_t>> leaves;
+    for (size_t i = 0; i < region_->max_metrics; ++i) {
+        shared_slot_t* s = slot(i);
+        if (s->state.load(std::memory_order_acquire) == STATE_READY &&
+            s->kind != KIND_NONE) {
+            leaves.emplace_back(split_name(s->name), i);
+        }
+    }
+    std::sort(leaves.begin(), leaves.end());
+
+    path_printer_t paths(printer);
+    std::vector<double> qvalues;
+    for (const auto& leaf : leaves) {
+        shared_slot_t* s = slot(leaf.second);
+        std::vector<uint64_t>& previous = previous_[leaf.second];
+
+        paths.leaf(leaf.first);
+        if (s->kind == KIND_COUNTER) {
+            auto value = static_cast<std::atomic<int64_t>*>(payload(s));
+            printer->value(int64_t(value->load(std::memory_order_relaxed)));
+        } else if (s->kind == KIND_METER) {
+            auto count = static_cast<std::atomic<uint64_t>*>(payload(s));
+            uint64_t current = count->load(std::memory_order_relaxed);
+
+            previous.resize(1);
+            double rate = elapsed > 0 ? (current - previous[0]) / elapsed : 0;
+            previous[0] = current;
+
+            printer->start_node();
+            printer->child("count");
+            printer->value(int64_t(current));
+            printer->child("rate");
+            printer->value(rate);
+            printer->end_node();
+        } else if (s->kind == KIND_HISTOGRAM) {
+            auto data = static_cast<shared_histogram_data_t*>(payload(s));
+
+            std::vector<uint64_t> delta(N_BUCKETS);
+            previous.resize(N_BUCKETS);
+            for (int b = 0; b < N_BUCKETS; ++b) {
+                uint64_t current =
+                    data->buckets()[b].load(std::memory_order_relaxed);
+                delta[b] = current - previous[b];
+                previous[b] = current;
+            }
+
+            get_quantiles(data->mapping, delta, &qvalues);
+
+            printer->start_node();
+            printer->child("q50");
+            printer->value(qvalues[0]);
+            printer->child("q80");
+            printer->value(qvalues[1]);
+            printer->child("q90");
+            printer->value(qvalues[2]);
+            printer->child("q95");
+            printer->value(qvalues[3]);
+            printer->child("q99");
+            printer->value(qvalues[4]);
+            printer->end_node();
+        }
+    }
+    paths.finish();
+}
+
+}  // namespace pm
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <pm/time.h>
+
+namespace pm {
+
+struct shared_region_t;
+struct shared_slot_t;
+struct shared_histogram_data_t;
+struct tree_printer_t;
+
+// instantaneous value of integer shared by all processes. inc() and dec()
+// of all processes add up, set() overwrites, the last writer wins.
+struct shared_counter_t {
+    shared_counter_t() : value_(nullptr) {}
+
+    void inc(int64_t amount = 1);
+    void dec(int64_t amount = 1);
+    void set(int64_t value);
+
+    // private
+    std::atomic<int64_t>* value_;
+};
+
+// number of events, rate is computed by the exporting process
+struct shared_meter_t {
+    shared_meter_t() : count_(nullptr) {}
+
+    void mark();
+
+    // private
+    std::atomic<uint64_t>* count_;
+};
+
+// distribution of data since the previous export
+struct shared_histogram_t {
+    shared_histogram_t() : data_(nullptr) {}
+
+    void update(int64_t value);
+
+    // private
+    shared_histogram_data_t* data_;
+};
+
+// collection of metrics placed in anonymous shared memory.
+//
+// Create it before fork(), after that every worker may register and update
+// metrics and any single process prints aggregated values. Names are full
+// paths with '.' as separator. Metrics are never removed.
+//
+// Every update is a single atomic operation on the region and registration
+// recovers slots claimed by processes that died in the middle, so a crashed
+// worker can't leave the region inconsistent. Such slot is detected by its
+// owner's pid, or after a second if the pid was reused meanwhile.
+class shared_registry_t {
+public:
+    explicit shared_registry_t(size_t max_metrics = 4096,
+                               size_t arena_size = 16 << 20);
+    ~shared_registry_t();
+
+    shared_registry_t(const shared_registry_t&) = delete;
+    shared_registry_t& operator = (const shared_registry_t&) = delete;
+
+    // return no-op metric if name is too long, registered with different
+    // type or the region is full
+    shared_counter_t counter(const std::string& name);
+    shared_meter_t meter(const std::string& name);
+    shared_histogram_t histogram(const std::string& name, int min, int max);
+
+    // meter rates and histogram quantiles cover the interval since the
+    // previous print() made by this process
+    void print(tree_printer_t* printer);
+
+private:
+    // lets tests leave slots in states only a crash can produce
+    friend struct shared_registry_test_access_t;
+
+    shared_region_t* region_;
+    size_t region_size_;
+
+    std::map<size_t, std::vector<uint64_t>> previous_;
+    time_point_t previous_print_;
+
+    shared_slot_t* slot(size_t index);
+    void* payload(shared_slot_t* slot);
+
+    shared_slot_t* find_or_create(const std::string& name, uint32_t kind,
+                                  size_t payload_size,
+                                  const std::function<void(void*)>& init);
+    void publish(shared_slot_t* slot, const std::string& name, uint32_t kind,
+                 uint32_t hash, size_t payload_size,
+                 const std::function<void(void*)>& init);
+};
+
+}  // namespace pm
@@ -0,0 +1,79 @@
+#include <pm/snapshot.h>
+
+namespace pm {
+
+void snapshot_t::recorder_t::start_node() {
+    snapshot_->entries_.emplace_back(START_NODE, 0);
+}
+
+void snapshot_t::recorder_t::end_node() {
+    snapshot_->entries_.emplace_back(END_NODE, 0);
+}
+
+void snapshot_t::recorder_t::child(const std::string& name) {
+    auto& names = snapshot_->names_;
+    auto& n_names = snapshot_->n_names_;
+
+    if (n_names == names.size()) {
+        names.push_back(name);
+    } else {
+        names[n_names] = name;
+    }
+
+    snapshot_->entries_.emplace_back(CHILD, n_names++);
+}
+
+void snapshot_t::recorder_t::value(double value) {
+    snapshot_->entries_.emplace_back(DOUBLE, 0);
+    snapshot_->entries_.back().double_value = value;
+}
+
+void snapshot_t::recorder_t::value(int64_t value) {
+    snapshot_->entries_.emplace_back(INT, 0);
+    snapshot_->entries_.back().int_value = value;
+}
+
+void snapshot_t::recorder_t::monotonic(uint64_t value) {
+    snapshot_->entries_.emplace_back(MONOTONIC, 0);
+    snapshot_->entries_.back().monotonic_value = value;
+}
+
+snapshot_t::snapshot_t() : n_names_(0) {}
+
+void snapshot_t::capture(registry_t registry) {
+    time_ = std::chrono::system_clock::now();
+    entries_.clear();
+    n_names_ = 0;
+
+    recorder_t recorder(this);
+    registry.print(&recorder);
+}
+
+void snapshot_t::print(tree_printer_t* printer) const {
+    printer->captured_at(time_);
+
+    for (const auto& entry : entries_) {
+        switch (entry.op) {
+            case START_NODE:
+                printer->start_node();
+                break;
+            case END_NODE:
+                printer->end_node();
+                break;
+            case CHILD:
+                printer->child(names_[entry.name]);
+                break;
+            case DOUBLE:
+                printer->value(entry.double_value);
+                break;
+            case INT:
+                printer->value(entry.int_value);
+                break;
+            case MONOTONIC:
+                printer->monotonic(entry.monotonic_value);
+                break;
+        }
+    }
+}
+
+}  // namespace pm
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <pm/metrics.h>
+#include <pm/tree.h>
+
+namespace pm {
+
+// values of all metrics captured in a single pass over registry, with rates
+// and quantiles computed for the same instant.
+//
+// Capture once per export cycle and print with as many printers as needed.
+// Memory is reused between captures, so steady state capture doesn't
+// allocate.
+class snapshot_t {
+public:
+    snapshot_t();
+
+    void capture(registry_t registry);
+    void print(tree_printer_t* printer) const;
+
+    time_point_t time() const { return time_; }
+
+private:
+    enum op_t : uint32_t { START_NODE, END_NODE, CHILD, DOUBLE, INT, MONOTONIC };
+
+    // child names are kept in separate array, so walking values touches
+    // only 16 bytes per entry
+    struct entry_t {
+        entry_t(op_t op, uint32_t name) : op(op), name(name), int_value(0) {}
+
+        op_t op;
+        uint32_t name;
+        union {
+            double double_value;
+            int64_t int_value;
+            uint64_t monotonic_value;
+        };
+    };
+
+    class recorder_t : public tree_printer_t {
+    public:
+        explicit recorder_t(snapshot_t* snapshot) : snapshot_(snapshot) {}
+
+        virtual void start_node();
+        virtual void end_node();
+
+        virtual void child(const std::string& name);
+        virtual void value(double value);
+        virtual void value(int64_t value);
+        virtual void monotonic(uint64_t value);
+
+        virtual time_point_t now() { return snapshot_->time_; }
+
+        virtual std::string result() const { return std::string(); }
+
+    private:
+        snapshot_t* snapshot_;
+    };
+
+    time_point_t time_;
+
+    std::vector<entry_t> entries_;
+
+    // slots are assigned in place to reuse string memory
+    std::vector<std::string> names_;
+    size_t n_names_;
+};
+
+}  // namespace pm
@@ -0,0 +1,416 @@
+#include <pm/spool.h>
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pm {
+
+static const char MAGIC[8] = {'P', 'M', 'S', 'P', 'O', 'O', 'L', '2'};
+// version without value types, still readable
+static const char UNTYPED_MAGIC[8] = {'P', 'M', 'S', 'P', 'O', 'O', 'L', '1'};
+
+// type of value stored after each name
+static const char DOUBLE_VALUE = 'd';
+static const char MONOTONIC_VALUE = 'm';
+static const size_t FRAME_HEADER_SIZE = 4;
+
+static uint64_t zigzag(int64_t v) { return (uint64_t(v) << 1) ^ (v >> 63); }
+static int64_t unzigzag(uint64_t v) { return int64_t(v >> 1) ^ -int64_t(v & 1); }
+
+static void put_varint(std::string* out, uint64_t v) {
+    while (v >= 0x80) {
+        out->push_back(char(v | 0x80));
+        v >>= 7;
+    }
+    out->push_back(char(v));
+}
+
+static bool get_varint(const char* data, size_t size, size_t* offset,
+                       uint64_t* v) {
+    *v = 0;
+    for (int shift = 0; shift < 64 && *offset < size; shift += 7) {
+        uint8_t byte = data[(*offset)++];
+        *v |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static uint64_t double_bits(double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+static double bits_double(uint64_t bits) {
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// control byte holds number of zero bytes on both sides of XOR-ed value,
+// only bytes in between are stored
+static void put_xor(std::string* out, uint64_t x) {
+    if (x == 0) {
+        out->push_back(char(8 << 4));
+        return;
+    }
+
+    int leading = __builtin_clzll(x) / 8;
+    int trailing = __builtin_ctzll(x) / 8;
+    out->push_back(char((leading << 4) | trailing));
+
+    x >>= trailing * 8;
+    for (int i = 0; i < 8 - leading - trailing; ++i) {
+        out->push_back(char(x & 0xff));
+        x >>= 8;
+    }
+}
+
+static bool get_xor(const char* data, size_t size, size_t* offset,
+                    uint64_t* x) {
+    if (*offset >= size) return false;
+    uint8_t control = data[(*offset)++];
+
+    int leading = control >> 4, trailing = control & 0xf;
+    if (leading + trailing > 8) return false;
+    if (leading == 8) {
+        *x = 0;
+        return true;
+    }
+
+    int n = 8 - leading - trailing;
+    if (*offset + n > size) return false;
+
+    *x = 0;
+    for (int i = 0; i < n; ++i) {
+        *x |= uint64_t(uint8_t(data[*offset + i])) << (8 * i);
+    }
+    *x <<= trailing * 8;
+    *offset += n;
+    return true;
+}
+
+void spool_writer_t::recorder_t::end_node() {
+    if (!key_sizes_.empty()) {
+        key_.resize(key_sizes_.back());
+        key_sizes_.pop_back();
+    }
+}
+
+void spool_writer_t::recorder_t::child(const std::string& name) {
+    key_sizes_.push_back(key_.size());
+    key_.append(name);
+    key_.push_back('\0');
+}
+
+void spool_writer_t::recorder_t::value(double value) {
+    record(DOUBLE_VALUE, double_bits(value));
+}
+
+void spool_writer_t::recorder_t::value(int64_t value) {
+    this->value(double(value));
+}
+
+void spool_writer_t::recorder_t::monotonic(uint64_t value) {
+    record(MONOTONIC_VALUE, value);
+}
+
+void spool_writer_t::recorder_t::record(char type, uint64_t bits) {
+    key_.push_back(type);
+    writer_->record(key_, bits);
+    key_.pop_back();
+    end_node();
+}
+
+spool_writer_t::spool_writer_t(const std::string& path, size_t max_file_size,
+                               int max_files)
+    : path_(path),
+      max_file_size_(max_file_size),
+      max_files_(max_files),
+      fd_(-1),
+      file_size_(0) {
+    open_file();
+    if (fd_ < 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "can't open spool " + path);
+    }
+
+    // encoding state of existing file is lost, start a new one
+    if (file_size_ > sizeof(MAGIC)) rotate();
+}
+
+spool_writer_t::~spool_writer_t() {
+    if (fd_ >= 0) close(fd_);
+}
+
+void spool_writer_t::open_file() {
+    fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) return;
+
+    struct stat st;
+    file_size_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+    if (file_size_ == 0 && write(fd_, MAGIC, sizeof(MAGIC)) == sizeof(MAGIC)) {
+        file_size_ = sizeof(MAGIC);
+    }
+
+    ids_.clear();
+    previous_values_.clear();
+    previous_timestamp_ = 0;
+    previous_delta_ = 0;
+}
+
+void spool_writer_t::rotate() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+
+    for (int i = max_files_ - 1; i >= 1; --i) {
+        std::string from = i == 1 ? path_ : path_ + "." + std::to_string(i - 1);
+        rename(from.c_str(), (path_ + "." + std::to_string(i)).c_str());
+    }
+    if (max_files_ <= 1) unlink(path_.c_str());
+
+    open_file();
+}
+
+void spool_writer_t::record(const std::string& key, uint64_t bits) {
+    auto it = ids_.find(key);
+    if (it == ids_.end()) {
+        it = ids_.emplace(key, ids_.size()).first;
+        previous_values_.push_back(0);
+
+        put_varint(&names_, key.size() - 1);
+        names_.append(key);
+        ++n_names_;
+    }
+
+    uint32_t id = it->second;
+
+    put_varint(&values_, zigzag(int64_t(id) - previous_id_ - 1));
+    put_xor(&values_, bits ^ previous_values_[id]);
+
+    previous_values_[id] = bits;
+    previous_id_ = id;
+    ++n_values_;
+}
+
+bool spool_writer_t::start_frame() {
+    if (fd_ < 0) open_file();
+    if (fd_ < 0) return false;
+
+    if (file_size_ >= max_file_size_) rotate();
+    if (fd_ < 0) return false;
+
+    names_.clear();
+    values_.clear();
+    n_names_ = n_values_ = 0;
+    previous_id_ = -1;
+    return true;
+}
+
+void spool_writer_t::append(registry_t registry, int64_t timestamp) {
+    if (!start_frame()) return;
+
+    recorder_t recorder(this);
+    registry.print(&recorder);
+
+    finish_frame(timestamp);
+}
+
+void spool_writer_t::append(const snapshot_t& snapshot, int64_t timestamp) {
+    if (!start_frame()) return;
+
+    recorder_t recorder(this);
+    snapshot.print(&recorder);
+
+    finish_frame(timestamp);
+}
+
+void spool_writer_t::finish_frame(int64_t timestamp) {
+    int64_t delta = timestamp - previous_timestamp_;
+
+    frame_.assign(FRAME_HEADER_SIZE, '\0');
+    put_varint(&frame_, zigzag(delta - previous_delta_));
+    put_varint(&frame_, n_names_);
+    frame_.append(names_);
+    put_varint(&frame_, n_values_);
+    frame_.append(values_);
+
+    uint32_t size = frame_.size() - FRAME_HEADER_SIZE;
+    for (size_t i = 0; i < FRAME_HEADER_SIZE; ++i) {
+        frame_[i] = char(size >> (8 * i));
+    }
+
+    previous_timestamp_ = timestamp;
+    previous_delta_ = delta;
+
+    ssize_t written = write(fd_, frame_.data(), frame_.size());
+    if (written == ssize_t(frame_.size())) {
+        file_size_ += written;
+    } else {
+        // frame is lost and encoding state is out of sync, start new file
+        file_size_ = max_file_size_;
+    }
+}
+
+spool_reader_t::spool_reader_t(const std::string& path)
+    : next_file_(0),
+      data_(nullptr),
+      size_(0),
+      offset_(0),
+      typed_(true),
+      timestamp_(0),
+      previous_delta_(0) {
+    for (int i = 1;; ++i) {
+        std::string rotated = path + "." + std::to_string(i);
+        if (access(rotated.c_str(), R_OK) != 0) break;
+        files_.insert(files_.begin(), rotated);
+    }
+    files_.push_back(path);
+}
+
+spool_reader_t::~spool_reader_t() { close_file(); }
+
+bool spool_reader_t::open_next_file() {
+    while (next_file_ < files_.size()) {
+        const std::string& file = files_[next_file_++];
+
+        int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(MAGIC)) {
+            close(fd);
+            continue;
+        }
+
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) continue;
+
+        data_ = static_cast<const char*>(data);
+        size_ = st.st_size;
+        offset_ = sizeof(MAGIC);
+
+        typed_ = memcmp(data_, MAGIC, sizeof(MAGIC)) == 0;
+        if (!typed_ && memcmp(data_, UNTYPED_MAGIC, sizeof(MAGIC)) != 0) {
+            close_file();
+            continue;
+        }
+
+        names_.clear();
+        types_.clear();
+        previous_values_.clear();
+        timestamp_ = 0;
+        previous_delta_ = 0;
+        return true;
+    }
+
+    return false;
+}
+
+void spool_reader_t::close_file() {
+    if (data_) {
+        munmap(const_cast<char*>(data_), size_);
+        data_ = nullptr;
+    }
+}
+
+bool spool_reader_t::next() {
+    while (true) {
+        if (!data_ && !open_next_file()) return false;
+        if (read_frame()) return true;
+        close_file();
+    }
+}
+
+bool spool_reader_t::read_frame() {
+    if (offset_ + FRAME_HEADER_SIZE > size_) return false;
+
+    uint32_t frame_size = 0;
+    for (size_t i = 0; i < FRAME_HEADER_SIZE; ++i) {
+        frame_size |= uint32_t(uint8_t(data_[offset_ + i])) << (8 * i);
+    }
+
+    size_t offset = offset_ + FRAME_HEADER_SIZE;
+    size_t end = offset + frame_size;
+    if (end > size_) return false;
+
+    uint64_t dod, n_names, n_values;
+    if (!get_varint(data_, end, &offset, &dod)) return false;
+    if (!get_varint(data_, end, &offset, &n_names)) return false;
+
+    for (uint64_t i = 0; i < n_names; ++i) {
+        uint64_t size;
+        if (!get_varint(data_, end, &offset, &size)) return false;
+        if (offset + size > end) return false;
+
+        // name is a sequence of path components, each followed by '\0'
+        std::vector<std::string> path;
+        const char* begin = data_ + offset;
+        for (const char* c = begin; c < data_ + offset + size; ++c) {
+            if (*c == '\0') {
+                path.emplace_back(begin, c);
+                begin = c + 1;
+            }
+        }
+        if (path.empty()) return false;
+        offset += size;
+
+        char type = DOUBLE_VALUE;
+        if (typed_) {
+            if (offset >= end) return false;
+            type = data_[offset++];
+        }
+
+        names_.push_back(path);
+        types_.push_back(type);
+        previous_values_.push_back(0);
+    }
+
+    if (!get_varint(data_, end, &offset, &n_values)) return false;
+
+    values_.clear();
+    int64_t id = -1;
+    for (uint64_t i = 0; i < n_values; ++i) {
+        uint64_t id_delta, x;
+        if (!get_varint(data_, end, &offset, &id_delta)) return false;
+        if (!get_xor(data_, end, &offset, &x)) return false;
+
+        id += unzigzag(id_delta) + 1;
+        if (id < 0 || size_t(id) >= names_.size()) return false;
+
+        previous_values_[id] ^= x;
+        values_.emplace_back(id, previous_values_[id]);
+    }
+
+    previous_delta_ += unzigzag(dod);
+    timestamp_ += previous_delta_;
+    offset_ = end;
+    return true;
+}
+
+void spool_reader_t::print(tree_printer_t* printer) {
+    printer->captured_at(std::chrono::system_clock::from_time_t(timestamp_));
+
+    path_printer_t paths(printer);
+    for (const auto& value : values_) {
+        paths.leaf(names_[value.first]);
+        if (types_[value.first] == MONOTONIC_VALUE) {
+            printer->monotonic(value.second);
+        } else {
+            printer->value(bits_double(value.second));
+        }
+    }
+    paths.finish();
+}
+
+}  // namespace pm
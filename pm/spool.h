@@ -0,0 +1,128 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <pm/metrics.h>
+#include <pm/snapshot.h>
+#include <pm/tree.h>
+
+namespace pm {
+
+// appends snapshots of registry to local files, so metrics collected while
+// graphite is unreachable can be replayed later.
+//
+// File starts with magic and holds a sequence of frames [uint32 size][data],
+// one frame per snapshot. Frame stores timestamp as delta-of-delta, metric
+// names seen for the first time with the type of their value and every
+// value XOR-ed with the previous value of the same metric. Monotonic values
+// are stored as uint64 and replayed through tree_printer_t::monotonic(),
+// everything else as double. Encoding state is reset when file is rotated, so
+// each file can be read on its own.
+//
+// When path grows above max_file_size it is renamed to path.1, path.1 to
+// path.2 and so on, at most max_files files are kept.
+class spool_writer_t {
+public:
+    spool_writer_t(const std::string& path, size_t max_file_size,
+                   int max_files);
+    ~spool_writer_t();
+
+    spool_writer_t(const spool_writer_t&) = delete;
+    spool_writer_t& operator = (const spool_writer_t&) = delete;
+
+    // timestamp is in seconds, same as graphite_printer_t
+    void append(registry_t registry, int64_t timestamp);
+    void append(const snapshot_t& snapshot, int64_t timestamp);
+
+private:
+    class recorder_t : public tree_printer_t {
+    public:
+        explicit recorder_t(spool_writer_t* writer) : writer_(writer) {}
+
+        virtual void start_node() {}
+        virtual void end_node();
+
+        virtual void child(const std::string& name);
+        virtual void value(double value);
+        virtual void value(int64_t value);
+        virtual void monotonic(uint64_t value);
+
+        virtual std::string result() const { return std::string(); }
+
+    private:
+        spool_writer_t* writer_;
+
+        void record(char type, uint64_t bits);
+
+        std::string key_;
+        std::vector<size_t> key_sizes_;
+    };
+
+    const std::string path_;
+    const size_t max_file_size_;
+    const int max_files_;
+
+    int fd_;
+    size_t file_size_;
+
+    // encoding state, reset on rotation
+    std::unordered_map<std::string, uint32_t> ids_;
+    std::vector<uint64_t> previous_values_;
+    int64_t previous_timestamp_, previous_delta_;
+
+    // frame being built, kept to reuse memory
+    std::string names_, values_, frame_;
+    uint32_t n_names_, n_values_;
+    int64_t previous_id_;
+
+    bool start_frame();
+    void finish_frame(int64_t timestamp);
+
+    void open_file();
+    void rotate();
+    // key is the name followed by type of the value
+    void record(const std::string& key, uint64_t bits);
+};
+
+// reads snapshots back from files written by spool_writer_t, oldest first.
+// Files are memory mapped, reading stops at the first truncated frame of
+// each file.
+class spool_reader_t {
+public:
+    explicit spool_reader_t(const std::string& path);
+    ~spool_reader_t();
+
+    spool_reader_t(const spool_reader_t&) = delete;
+    spool_reader_t& operator = (const spool_reader_t&) = delete;
+
+    // advance to the next snapshot, false when all files are read
+    bool next();
+
+    int64_t timestamp() const { return timestamp_; }
+    void print(tree_printer_t* printer);
+
+private:
+    std::vector<std::string> files_;
+    size_t next_file_;
+
+    const char* data_;
+    size_t size_, offset_;
+
+    // files written before types were stored hold doubles only
+    bool typed_;
+    std::vector<std::vector<std::string>> names_;
+    std::vector<char> types_;
+    std::vector<uint64_t> previous_values_;
+    int64_t timestamp_, previous_delta_;
+
+    // id and bits of values of the current frame
+    std::vector<std::pair<uint32_t, uint64_t>> values_;
+
+    bool open_next_file();
+    void close_file();
+    bool read_frame();
+};
+
+}  // namespace pm
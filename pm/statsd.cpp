@@ -0,0 +1,376 @@
+#include <pm/statsd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <system_error>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace pm {
+
+static const size_t BATCH_SIZE = 64;
+static const size_t MAX_PACKET_SIZE = 8192;
+static const int RECEIVE_BUFFER_SIZE = 4 << 20;
+
+// meter is marked in bulk, but a single line shouldn't make it overflow
+static const double MAX_MARKS = 1e9;
+
+static void throw_errno(const std::string& what) {
+    throw std::system_error(errno, std::system_category(), what);
+}
+
+// parses [+-]digits[.digits][e[+-]digits], strtod needs NUL terminated
+// input and depends on locale
+static bool parse_number(const char* begin, const char* end, double* value) {
+    const char* c = begin;
+    bool negative = false;
+    if (c < end && (*c == '+' || *c == '-')) negative = *c++ == '-';
+
+    double result = 0;
+    int n_digits = 0, exponent = 0;
+    for (; c < end && *c >= '0' && *c <= '9'; ++c, ++n_digits) {
+        result = result * 10 + (*c - '0');
+    }
+    if (c < end && *c == '.') {
+        for (++c; c < end && *c >= '0' && *c <= '9'; ++c, ++n_digits) {
+            result = result * 10 + (*c - '0');
+            --exponent;
+        }
+    }
+    if (n_digits == 0) return false;
+
+    if (c < end && (*c == 'e' || *c == 'E')) {
+        ++c;
+        bool negative_exponent = false;
+        if (c < end && (*c == '+' || *c == '-')) negative_exponent = *c++ == '-';
+
+        int e = 0;
+        const char* digits = c;
+        for (; c < end && *c >= '0' && *c <= '9' && e < 1000; ++c) {
+            e = e * 10 + (*c - '0');
+        }
+        if (c == digits) return false;
+        exponent += negative_exponent ? -e : e;
+    }
+    if (c != end) return false;
+
+    if (exponent != 0) result *= std::pow(10., exponent);
+    *value = negative ? -result : result;
+    return std::isfinite(*value);
+}
+
+statsd_server_t::statsd_server_t(registry_t registry, size_t max_metrics)
+    : registry_(registry),
+      histogram_min_(1),
+      histogram_max_(0),
+      max_metrics_(max_metrics),
+      n_lines_(0),
+      n_bad_lines_(0) {
+    if (pipe2(wake_fds_, O_CLOEXEC | O_NONBLOCK) != 0) {
+        throw_errno("can't create statsd wake pipe");
+    }
+}
+
+statsd_server_t::~statsd_server_t() {
+    stop();
+
+    for (int fd : fds_) close(fd);
+    // only remove socket files still being the ones bound here
+    for (const auto& socket : unix_sockets_) {
+        struct stat st;
+        if (lstat(socket.path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) &&
+            st.st_dev == socket.dev && st.st_ino == socket.ino) {
+            unlink(socket.path.c_str());
+        }
+    }
+    close(wake_fds_[0]);
+    close(wake_fds_[1]);
+}
+
+void statsd_server_t::set_histogram_range(int min, int max) {
+    histogram_min_ = min;
+    histogram_max_ = max;
+}
+
+int statsd_server_t::listen_udp(int port, const std::string& address) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+        throw std::system_error(EINVAL, std::system_category(),
+                                "bad statsd address " + address);
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw_errno("can't create statsd socket");
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &RECEIVE_BUFFER_SIZE,
+               sizeof(RECEIVE_BUFFER_SIZE));
+
+    socklen_t size = sizeof(addr);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &size) != 0) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::system_category(),
+                                "can't bind statsd socket to " + address +
+                                    ":" + std::to_string(port));
+    }
+
+    fds_.push_back(fd);
+    return ntohs(addr.sin_port);
+}
+
+void statsd_server_t::listen_unix(const std::string& path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::system_error(ENAMETOOLONG, std::system_category(),
+                                "bad statsd socket path " + path);
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw_errno("can't create statsd socket");
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &RECEIVE_BUFFER_SIZE,
+               sizeof(RECEIVE_BUFFER_SIZE));
+
+    // socket file may be left behind by a previous process, anything else
+    // at the path is not ours to remove
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            close(fd);
+            throw std::system_error(EEXIST, std::system_category(),
+                                    "can't bind statsd socket to " + path +
+                                        ", path exists and is not a socket");
+        }
+        unlink(path.c_str());
+    }
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        lstat(path.c_str(), &st) != 0) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::system_category(),
+                                "can't bind statsd socket to " + path);
+    }
+
+    fds_.push_back(fd);
+    unix_sockets_.push_back({path, st.st_dev, st.st_ino});
+}
+
+void statsd_server_t::start() {
+    if (!thread_.joinable()) thread_ = std::thread([this] { run(); });
+}
+
+void statsd_server_t::stop() {
+    if (!thread_.joinable()) return;
+
+    char byte = 0;
+    while (write(wake_fds_[1], &byte, 1) < 0 && errno == EINTR) {}
+    thread_.join();
+
+    while (read(wake_fds_[0], &byte, 1) > 0) {}
+}
+
+void statsd_server_t::run() {
+    std::vector<pollfd> pollfds;
+    for (int fd : fds_) pollfds.push_back({fd, POLLIN, 0});
+    pollfds.push_back({wake_fds_[0], POLLIN, 0});
+
+    // one extra byte per packet to tell truncated packets apart
+    std::vector<char> buffer(BATCH_SIZE * (MAX_PACKET_SIZE + 1));
+    std::vector<iovec> iovecs(BATCH_SIZE);
+    std::vector<mmsghdr> messages(BATCH_SIZE);
+
+    while (true) {
+        if (poll(pollfds.data(), pollfds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        if (pollfds.back().revents) return;
+
+        for (size_t i = 0; i + 1 < pollfds.size(); ++i) {
+            if (!pollfds[i].revents) continue;
+
+            // drain the socket, so a busy one doesn't need a poll per batch
+            while (true) {
+                for (size_t j = 0; j < BATCH_SIZE; ++j) {
+                    iovecs[j].iov_base = &buffer[j * (MAX_PACKET_SIZE + 1)];
+                    iovecs[j].iov_len = MAX_PACKET_SIZE + 1;
+                    memset(&messages[j], 0, sizeof(messages[j]));
+                    messages[j].msg_hdr.msg_iov = &iovecs[j];
+                    messages[j].msg_hdr.msg_iovlen = 1;
+                }
+
+                int n = recvmmsg(pollfds[i].fd, messages.data(), BATCH_SIZE,
+                                 MSG_DONTWAIT, nullptr);
+                if (n <= 0) break;
+
+                for (int j = 0; j < n; ++j) {
+                    size_t size = messages[j].msg_len;
+                    if (size > MAX_PACKET_SIZE) {
+                        n_bad_lines_.fetch_add(1, std::memory_order_relaxed);
+                        continue;
+                    }
+                    process(static_cast<const char*>(iovecs[j].iov_base), size);
+                }
+
+                if (size_t(n) < BATCH_SIZE) break;
+            }
+        }
+    }
+}
+
+void statsd_server_t::process(const char* data, size_t size) {
+    const char* end = data + size;
+    uint64_t n_lines = 0, n_bad_lines = 0;
+
+    while (data < end) {
+        const char* eol = static_cast<const char*>(memchr(data, '\n', end - data));
+        if (!eol) eol = end;
+
+        const char* line_end = eol;
+        if (line_end > data && line_end[-1] == '\r') --line_end;
+
+        if (line_end > data) {
+            ++n_lines;
+            if (!process_line(data, line_end)) ++n_bad_lines;
+        }
+        data = eol + 1;
+    }
+
+    n_lines_.fetch_add(n_lines, std::memory_order_relaxed);
+    if (n_bad_lines) n_bad_lines_.fetch_add(n_bad_lines, std::memory_order_relaxed);
+}
+
+bool statsd_server_t::process_line(const char* begin, const char* end) {
+    const char* colon = static_cast<const char*>(memchr(begin, ':', end - begin));
+    if (!colon || colon == begin) return false;
+
+    const char* value_begin = colon + 1;
+    const char* bar = static_cast<const char*>(memchr(value_begin, '|', end - value_begin));
+    if (!bar) return false;
+
+    const char* type_begin = bar + 1;
+    const char* type_end = static_cast<const char*>(memchr(type_begin, '|', end - type_begin));
+    if (!type_end) type_end = end;
+
+    double value;
+    if (!parse_number(value_begin, bar, &value)) return false;
+
+    // optional sections are "@sample_rate" and "#tags", tags are ignored
+    double sample_rate = 1;
+    for (const char* section = type_end; section < end;) {
+        const char* section_begin = section + 1;
+        section = static_cast<const char*>(memchr(section_begin, '|', end - section_begin));
+        if (!section) section = end;
+
+        if (section_begin < section && *section_begin == '@') {
+            if (!parse_number(section_begin + 1, section, &sample_rate) ||
+                sample_rate <= 0 || sample_rate > 1) {
+                return false;
+            }
+        }
+    }
+
+    char type;
+    size_t type_size = type_end - type_begin;
+    if (type_size == 1 && strchr("cghm", *type_begin)) {
+        type = *type_begin;
+    } else if (type_size == 2 && type_begin[0] == 'm' && type_begin[1] == 's') {
+        type = 't';
+    } else {
+        return false;
+    }
+
+    // gauges and counters share counter_t
+    metric_t* metric = find(begin, colon - begin, type == 'g' ? 'c' : type);
+    if (!metric) return false;
+
+    switch (type) {
+        case 'c':
+            metric->counter.inc(std::llround(value / sample_rate));
+            break;
+        case 'g':
+            if (*value_begin == '+' || *value_begin == '-') {
+                metric->counter.inc(std::llround(value));
+            } else {
+                metric->counter.set(std::llround(value));
+            }
+            break;
+        case 'm': {
+            double count = value / sample_rate;
+            if (count < 0 || count > MAX_MARKS) return false;
+            metric->meter.mark(std::llround(count));
+            break;
+        }
+        case 't':
+            metric->timer.update(std::llround(value));
+            break;
+        case 'h':
+            metric->histogram.update(std::llround(value));
+            break;
+    }
+    return true;
+}
+
+statsd_server_t::metric_t* statsd_server_t::find(const char* name, size_t size,
+                                                 char type) {
+    key_.assign(name, size);
+
+    auto it = metrics_.find(key_);
+    if (it != metrics_.end()) {
+        return it->second.type == type ? &it->second : nullptr;
+    }
+    if (metrics_.size() >= max_metrics_) return nullptr;
+
+    registry_t registry = registry_;
+    size_t start = 0;
+    while (true) {
+        size_t dot = key_.find('.', start);
+        if (dot == start || start == key_.size()) return nullptr;
+        if (dot == std::string::npos) break;
+
+        registry = registry.subtree(key_.substr(start, dot - start));
+        start = dot + 1;
+    }
+    std::string leaf = key_.substr(start);
+
+    metric_t metric;
+    metric.type = type;
+    switch (type) {
+        case 'c':
+            metric.counter = registry.counter(leaf);
+            break;
+        case 'm':
+            metric.meter = registry.meter(leaf);
+            break;
+        case 't':
+            metric.timer = registry.timer(leaf);
+            break;
+        case 'h':
+            if (histogram_min_ <= histogram_max_) {
+                metric.histogram = registry.histogram(leaf, histogram_min_, histogram_max_);
+            } else {
+                metric.histogram = registry.histogram(leaf);
+            }
+            break;
+    }
+
+    return &metrics_.emplace(key_, metric).first->second;
+}
+
+}  // namespace pm
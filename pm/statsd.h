@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <pm/metrics.h>
+
+namespace pm {
+
+// receives StatsD lines over UDP or unix datagram sockets and updates
+// metrics of the registry, so scripts running next to the process can
+// report through it.
+//
+// Lines are "name:value|type[|@sample_rate]", several lines per packet
+// separated by '\n'. Types map to metrics as
+//   c  - counter_t::inc(value / sample_rate)
+//   g  - counter_t::set(value), or inc/dec when value starts with +/-
+//   ms - timer_t::update(value)
+//   h  - histogram_t with automatic range, see set_histogram_range()
+//   m  - meter_t, marked value / sample_rate times
+// Dots in names create subtrees. Metrics are registered on first use and
+// kept by the server, at most max_metrics of them.
+class statsd_server_t {
+public:
+    explicit statsd_server_t(registry_t registry, size_t max_metrics = 10000);
+    ~statsd_server_t();
+
+    statsd_server_t(const statsd_server_t&) = delete;
+    statsd_server_t& operator = (const statsd_server_t&) = delete;
+
+    // histograms registered afterwards get linear buckets over [min, max],
+    // values outside go to underflow and overflow. Should be called before
+    // start().
+    void set_histogram_range(int min, int max);
+
+    // should be called before start(), throw std::system_error on failure.
+    // Port 0 picks a free port, bound port is returned. Stale socket file
+    // at path is replaced, any other file is left alone and is an error.
+    int listen_udp(int port, const std::string& address = "127.0.0.1");
+    void listen_unix(const std::string& path);
+
+    // receive in background thread until stop() or destruction
+    void start();
+    void stop();
+
+    // parses one packet, called by the receiving thread
+    void process(const char* data, size_t size);
+
+    uint64_t n_lines() const { return n_lines_.load(std::memory_order_relaxed); }
+    uint64_t n_bad_lines() const { return n_bad_lines_.load(std::memory_order_relaxed); }
+
+private:
+    struct metric_t {
+        char type;
+        counter_t counter;
+        meter_t meter;
+        timer_t timer;
+        histogram_t histogram;
+    };
+
+    registry_t registry_;
+    // fixed histogram range, automatic if min > max
+    int histogram_min_, histogram_max_;
+    const size_t max_metrics_;
+
+    std::vector<int> fds_;
+    struct unix_socket_t {
+        std::string path;
+        dev_t dev;
+        ino_t ino;
+    };
+    std::vector<unix_socket_t> unix_sockets_;
+    int wake_fds_[2];
+    std::thread thread_;
+
+    // name is copied into key_ for lookup, so hits don't allocate
+    std::unordered_map<std::string, metric_t> metrics_;
+    std::string key_;
+
+    std::atomic<uint64_t> n_lines_, n_bad_lines_;
+
+    void run();
+    bool process_line(const char* begin, const char* end);
+    metric_t* find(const char* name, size_t size, char type);
+};
+
+}  // namespace pm
@@ -1,11 +1,69 @@
 #include <pm/tree.h>
 
 #include <ctime>
+#include <typeinfo>
+
+#include <pm/self.h>
 
 namespace pm {
 
+// measures time spent waiting only when the mutex is contended and self
+// stats are enabled
+class tree_lock_t {
+public:
+    explicit tree_lock_t(std::mutex& mutex) : mutex_(mutex) {
+        if (mutex_.try_lock()) return;
+
+        self_stats_t& stats = self_stats();
+        if (!stats.enabled()) {
+            mutex_.lock();
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        mutex_.lock();
+        uint64_t waited = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+        stats.tree_lock_waits.fetch_add(1, std::memory_order_relaxed);
+        stats.tree_lock_wait_ns.fetch_add(waited, std::memory_order_relaxed);
+    }
+
+    ~tree_lock_t() { mutex_.unlock(); }
+
+private:
+    std::mutex& mutex_;
+};
+
+// approximate, red-black tree node header is 4 words
+size_t tree_branch_t::node_bytes(const std::string& name) {
+    return 4 * sizeof(void*) + sizeof(childs_t::value_type) + name.size();
+}
+
+tree_branch_t::tree_branch_t() : tree_branch_t(std::make_shared<owned_leaves_t>()) {}
+
+tree_branch_t::tree_branch_t(std::shared_ptr<owned_leaves_t> owned)
+    : owned_(owned), hand_(childs_.end()) {
+    self_stats().tree_bytes.fetch_add(sizeof(tree_branch_t), std::memory_order_relaxed);
+}
+
+tree_branch_t::~tree_branch_t() {
+    int64_t bytes = sizeof(tree_branch_t);
+    for (const auto& child : childs_) bytes += node_bytes(child.first);
+    self_stats().tree_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+tree_branch_t::child_ptr_t& tree_branch_t::find_or_insert(const std::string& name) {
+    auto it = childs_.lower_bound(name);
+    if (it == childs_.end() || it->first != name) {
+        it = childs_.emplace_hint(it, name, child_ptr_t());
+        self_stats().tree_bytes.fetch_add(node_bytes(name), std::memory_order_relaxed);
+    }
+    return it->second;
+}
+
 bool tree_branch_t::remove_empty_nodes() {
-    std::lock_guard<std::mutex> guard(mutex_);
+    tree_lock_t guard(mutex_);
 
     for (auto it = childs_.begin(); it != childs_.end();) {
         auto node = it++;
@@ -13,10 +71,10 @@ bool tree_branch_t::remove_empty_nodes() {
         if (node->second.branch) {
             bool empty = node->second.branch->remove_empty_nodes();
             if (empty && node->second.branch.unique()) {
-                childs_.erase(node);
+                erase(node);
             }
         } else if (node->second.leaf.expired()) {
-            childs_.erase(node);
+            erase(node);
         }
     }
 
@@ -24,30 +82,94 @@ bool tree_branch_t::remove_empty_nodes() {
 }
 
 void tree_branch_t::print(tree_printer_t* printer) {
-    std::lock_guard<std::mutex> guard(mutex_);
+    tree_lock_t guard(mutex_);
+    print_locked(printer);
+}
 
+bool tree_branch_t::print_locked(tree_printer_t* printer) {
     printer->start_node();
-    for (const auto& child : childs_) {
-        if (child.second.branch) {
-            printer->child(child.first);
-            child.second.branch->print(printer);
+    for (auto it = childs_.begin(); it != childs_.end();) {
+        auto node = it++;
+
+        if (node->second.branch) {
+            printer->child(node->first);
+
+            tree_branch_t& branch = *node->second.branch;
+            bool empty;
+            {
+                tree_lock_t guard(branch.mutex_);
+                empty = branch.print_locked(printer);
+            }
+
+            // nobody can get a new reference while our mutex is held
+            if (empty && node->second.branch.unique()) erase(node);
         } else if (std::shared_ptr<tree_leaf_t> leaf =
-                       child.second.leaf.lock()) {
-            printer->child(child.first);
+                       node->second.leaf.lock()) {
+            printer->child(node->first);
             leaf->print(printer);
+        } else {
+            erase(node);
         }
     }
     printer->end_node();
+
+    return childs_.empty();
+}
+
+bool tree_branch_t::sweep(size_t* budget) {
+    for (size_t n = childs_.size(); n > 0 && *budget > 0; --n, --*budget) {
+        if (hand_ == childs_.end()) hand_ = childs_.begin();
+        auto node = hand_++;
+
+        if (node->second.branch) {
+            if (!node->second.branch.unique()) continue;
+
+            tree_branch_t& branch = *node->second.branch;
+            bool empty;
+            {
+                tree_lock_t guard(branch.mutex_);
+                empty = branch.sweep(budget);
+            }
+            if (empty) erase(node);
+
+            if (*budget == 0) break;
+        } else if (node->second.leaf.expired()) {
+            erase(node);
+        }
+    }
+
+    return childs_.empty();
+}
+
+void tree_branch_t::erase(childs_t::iterator it) {
+    if (hand_ == it) ++hand_;
+    self_stats().tree_bytes.fetch_sub(node_bytes(it->first), std::memory_order_relaxed);
+    childs_.erase(it);
+}
+
+size_t tree_branch_t::size() {
+    tree_lock_t guard(mutex_);
+
+    size_t size = childs_.size();
+    for (const auto& child : childs_) {
+        if (child.second.branch) size += child.second.branch->size();
+    }
+    return size;
 }
 
 std::shared_ptr<tree_branch_t> tree_branch_t::get_branch(
     const std::string& name) {
-    std::lock_guard<std::mutex> guard(mutex_);
+    tree_lock_t guard(mutex_);
+
+    // before insertion, so the new branch isn't taken for an unused one
+    size_t budget = SWEEP_BUDGET;
+    sweep(&budget);
 
-    auto& child = childs_[name];
+    child_ptr_t& child = find_or_insert(name);
     if (!child.branch) {
         child.leaf.reset();
-        child.branch = std::make_shared<tree_branch_t>();
+        child.owned = false;
+        child.branch = std::shared_ptr<tree_branch_t>(new tree_branch_t(owned_));
     }
 
     return child.branch;
@@ -55,14 +177,87 @@ std::shared_ptr<tree_branch_t> tree_branch_t::get_branch(
 
 void tree_branch_t::add_leaf(const std::string& name,
                              std::weak_ptr<tree_leaf_t> leaf) {
-    std::lock_guard<std::mutex> guard(mutex_);
+    tree_lock_t guard(mutex_);
 
-    auto& child = childs_[name];
+    size_t budget = SWEEP_BUDGET;
+    sweep(&budget);
+
+    child_ptr_t& child = find_or_insert(name);
     if (child.branch) {
         child.branch.reset();
     }
 
     child.leaf = leaf;
+    child.owned = false;
+}
+
+std::shared_ptr<tree_leaf_t> tree_branch_t::add_owned_leaf(
+    const std::string& name, std::shared_ptr<tree_leaf_t> leaf) {
+    tree_lock_t guard(mutex_);
+
+    size_t budget = SWEEP_BUDGET;
+    sweep(&budget);
+
+    child_ptr_t& child = find_or_insert(name);
+    if (child.branch) {
+        child.branch.reset();
+    } else if (child.owned) {
+        // owned leaves never expire
+        std::shared_ptr<tree_leaf_t> current = child.leaf.lock();
+        if (typeid(*current) == typeid(*leaf)) return current;
+    }
+
+    {
+        std::lock_guard<std::mutex> owned_guard(owned_->mutex);
+        owned_->leaves.push_back(leaf);
+    }
+
+    child.leaf = leaf;
+    child.owned = true;
+    return leaf;
+}
+
+path_printer_t::path_printer_t(tree_printer_t* printer)
+    : printer_(printer), started_(false) {}
+
+void path_printer_t::leaf(const std::vector<std::string>& path) {
+    if (!started_) {
+        printer_->start_node();
+        started_ = true;
+    }
+
+    size_t common = 0;
+    while (common < open_.size() && common + 1 < path.size() &&
+           open_[common] == path[common]) {
+        ++common;
+    }
+
+    while (open_.size() > common) {
+        printer_->end_node();
+        open_.pop_back();
+    }
+
+    for (size_t i = common; i + 1 < path.size(); ++i) {
+        printer_->child(path[i]);
+        printer_->start_node();
+        open_.push_back(path[i]);
+    }
+
+    printer_->child(path.back());
+}
+
+void path_printer_t::finish() {
+    if (!started_) {
+        printer_->start_node();
+        started_ = true;
+    }
+
+    while (!open_.empty()) {
+        printer_->end_node();
+        open_.pop_back();
+    }
+
+    printer_->end_node();
 }
 
 }  // namespace pm
@@ -7,6 +7,8 @@
 #include <memory>
 #include <map>
 
+#include <pm/time.h>
+
 namespace pm {
 
 struct tree_printer_t {
@@ -17,6 +19,16 @@ struct tree_printer_t {
     virtual void value(double value) = 0;
     virtual void value(int64_t value) = 0;
     virtual void value(uint64_t value_) { value(int64_t(value_)); }
+    // cumulative total that only grows, except when it wraps around or the
+    // process restarts. See rate_printer_t for exporting it as a rate.
+    virtual void monotonic(uint64_t value_) { value(value_); }
+
+    // time at which leaves compute printed values
+    virtual time_point_t now() { return std::chrono::system_clock::now(); }
+
+    // called before the root node by sources replaying values taken
+    // earlier (snapshot_t, spool_reader_t) with the time they were taken
+    virtual void captured_at(time_point_t time) {}
 
     virtual std::string result() const = 0;
 
@@ -25,24 +37,90 @@ struct tree_printer_t {
 
 struct tree_leaf_t {
     virtual void print(tree_printer_t* printer) = 0;
+
+    virtual ~tree_leaf_t() {}
 };
 
+// Dead leaves and empty branches nobody else refers to are removed
+// incrementally: print() drops the ones it walks over and every
+// registration checks a few more children, resuming where the previous
+// one stopped, so the tree stays proportional to live metrics without
+// a full cleanup pass.
 class tree_branch_t {
 public:
+    tree_branch_t();
+    ~tree_branch_t();
+
+    tree_branch_t(const tree_branch_t&) = delete;
+    tree_branch_t& operator = (const tree_branch_t&) = delete;
+
     void print(tree_printer_t* printer);
     bool remove_empty_nodes();
 
     std::shared_ptr<tree_branch_t> get_branch(const std::string& name);
     void add_leaf(const std::string& name, std::weak_ptr<tree_leaf_t> leaf);
+    // leaf is kept alive until every branch of the tree is destroyed, even
+    // once the name is registered again, so plain pointers to it stay
+    // valid. Returns the leaf owned under name if it has the same type,
+    // the given one otherwise.
+    std::shared_ptr<tree_leaf_t> add_owned_leaf(const std::string& name,
+                                                std::shared_ptr<tree_leaf_t> leaf);
+
+    // number of nodes in the subtree, dead ones included
+    size_t size();
 
 private:
+    // children checked per registration, including nested ones
+    static const size_t SWEEP_BUDGET = 4;
+
     struct child_ptr_t {
+        child_ptr_t() : owned(false) {}
+
         std::weak_ptr<tree_leaf_t> leaf;
+        // leaf is kept by owned_leaves_t
+        bool owned;
         std::shared_ptr<tree_branch_t> branch;
     };
+    typedef std::map<std::string, child_ptr_t> childs_t;
+
+    // owned leaves of the whole tree, shared by all its branches
+    struct owned_leaves_t {
+        std::mutex mutex;
+        std::vector<std::shared_ptr<tree_leaf_t>> leaves;
+    };
+
+    explicit tree_branch_t(std::shared_ptr<owned_leaves_t> owned);
 
     std::mutex mutex_;
-    std::map<std::string, child_ptr_t> childs_;
+    childs_t childs_;
+    std::shared_ptr<owned_leaves_t> owned_;
+
+    // next child to be checked by sweep()
+    childs_t::iterator hand_;
+
+    // return true if branch is empty afterwards, called with mutex_ held
+    bool print_locked(tree_printer_t* printer);
+    bool sweep(size_t* budget);
+
+    child_ptr_t& find_or_insert(const std::string& name);
+    static size_t node_bytes(const std::string& name);
+    void erase(childs_t::iterator it);
+};
+
+// drives printer with leaves given by their full path instead of a
+// tree walk. Paths sharing a prefix must come one after another (e.g. sorted).
+class path_printer_t {
+public:
+    explicit path_printer_t(tree_printer_t* printer);
+
+    // positions printer at the leaf, caller prints its value right after
+    void leaf(const std::vector<std::string>& path);
+    void finish();
+
+private:
+    tree_printer_t* printer_;
+    bool started_;
+    std::vector<std::string> open_;
 };
 
 }  // namespace pm
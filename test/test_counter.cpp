@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <cmath>
 #include <random>
+#include <thread>
 
 #include <pm/counter.h>
 
@@ -7,6 +9,92 @@
 
 using namespace pm;
 
+TEST(spinlock_test_t, mutual_exclusion) {
+    spinlock_t lock;
+
+    // non-atomic read-modify-write loses updates without exclusion
+    volatile int64_t value = 0;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&lock, &value] {
+            for (int j = 0; j < 100000; ++j) {
+                std::lock_guard<spinlock_t> guard(lock);
+                value = value + 1;
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    ASSERT_EQ(400000, value);
+}
+
+// holds lock for hold after waiter thread started, waiter may or may not
+// reach lock() in time, so callers retry until contention is seen
+template <class lock_t>
+static void contend(lock_t* lock, std::chrono::milliseconds hold) {
+    std::atomic<bool> started(false);
+
+    lock->lock();
+    std::thread waiter([lock, &started] {
+        started = true;
+        lock->lock();
+        lock->unlock();
+    });
+    while (!started) std::this_thread::yield();
+    std::this_thread::sleep_for(hold);
+    lock->unlock();
+    waiter.join();
+}
+
+TEST(spinlock_test_t, stats) {
+    basic_spinlock_t<SPACE_SAVING_COUNTER_LOCK> lock;
+    spinlock_stats_t* stats = lock_site_stats(SPACE_SAVING_COUNTER_LOCK);
+    uint64_t contended = stats->contended.load();
+    uint64_t spins = stats->spins.load();
+    uint64_t yields = stats->yields.load();
+
+    // not collected while disabled
+    for (int i = 0; i < 3; ++i) contend(&lock, std::chrono::milliseconds(5));
+    EXPECT_EQ(contended, stats->contended.load());
+
+    ++lock_stats_users();
+    for (int i = 1; i <= 100 && stats->yields.load() == yields; ++i) {
+        contend(&lock, std::chrono::milliseconds(i));
+    }
+    --lock_stats_users();
+
+    EXPECT_GT(stats->contended.load(), contended);
+    EXPECT_GT(stats->spins.load(), spins);
+    EXPECT_GT(stats->yields.load(), yields);
+
+    // uncontended acquisition isn't counted
+    contended = stats->contended.load();
+    ++lock_stats_users();
+    lock.lock();
+    lock.unlock();
+    --lock_stats_users();
+    EXPECT_EQ(contended, stats->contended.load());
+}
+
+TEST(striped_counter_test_t, many_threads) {
+    striped_counter_t c;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&c] {
+            for (int i = 0; i < 100000; ++i) c.add(1);
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    EXPECT_EQ(400000u, c.load());
+
+    // wraps around like uint64_t
+    c.add(~uint64_t(0) - 399999);
+    EXPECT_EQ(0u, c.load());
+}
+
 TEST(double_buffer_counter_test_t, full) {
     auto now = std::chrono::system_clock::now();
     auto window_size = std::chrono::seconds(10);
@@ -102,3 +190,173 @@ TEST(histogram_counter_test_t, decay) {
 		EXPECT_EQ(0.0, qvalues[i]);
 	}
 }
+
+TEST(histogram_counter_test_t, out_of_range) {
+    histogram_counter_t histogram(std::chrono::seconds(1), linear_mapping_t(0, 100, 100));
+
+    auto now = std::chrono::system_clock::now();
+    histogram.update(now, -5);
+    histogram.update(now, 0);
+    histogram.update(now, 100);
+    histogram.update(now, 101);
+
+    EXPECT_EQ(1u, histogram.underflow());
+    EXPECT_EQ(1u, histogram.overflow());
+}
+
+TEST(auto_histogram_counter_test_t, any_scale) {
+    for (double scale : {1e-3, 1., 1e6}) {
+        auto_histogram_counter_t histogram(std::chrono::hours(1));
+
+        auto now = std::chrono::system_clock::now();
+        for (int i = 1; i <= 1000; ++i) histogram.update(now, i * scale);
+
+        std::vector<double> q = { 0.5, 0.9, 0.99 };
+        std::vector<double> qvalues;
+        histogram.get_quantiles(now, q, &qvalues);
+
+        EXPECT_NEAR(500 * scale, qvalues[0], 500 * scale * 0.04);
+        EXPECT_NEAR(900 * scale, qvalues[1], 900 * scale * 0.04);
+        EXPECT_NEAR(990 * scale, qvalues[2], 990 * scale * 0.04);
+    }
+}
+
+TEST(auto_histogram_counter_test_t, memory_follows_range) {
+    auto_histogram_counter_t narrow(std::chrono::hours(1)), wide(std::chrono::hours(1));
+
+    auto now = std::chrono::system_clock::now();
+    for (int i = 0; i < 1000; ++i) {
+        narrow.update(now, 100 + i % 20);
+        wide.update(now, std::pow(2., i % 40));
+    }
+
+    EXPECT_LT(narrow.memory_usage() * 10, wide.memory_usage());
+}
+
+TEST(auto_histogram_counter_test_t, out_of_range) {
+    auto_histogram_counter_t histogram(std::chrono::hours(1));
+
+    auto now = std::chrono::system_clock::now();
+    histogram.update(now, 0);
+    histogram.update(now, -1);
+    histogram.update(now, 1e300);
+    histogram.update(now, INFINITY);
+
+    EXPECT_EQ(1u, histogram.underflow());
+    EXPECT_EQ(2u, histogram.overflow());
+
+    std::vector<double> qvalues;
+    histogram.get_quantiles(now, {0.1, 0.9}, &qvalues);
+    EXPECT_EQ(0, qvalues[0]);
+    EXPECT_EQ(std::ldexp(1., auto_histogram_counter_t::MAX_EXPONENT - 1), qvalues[1]);
+}
+
+TEST(summary_counter_test_t, windows) {
+    summary_counter_t summary(std::chrono::seconds(10));
+    auto now = time_point_t(std::chrono::seconds(1000));
+
+    // large offset would lose precision with plain sums of squares
+    for (int i = 0; i < 1000; ++i) summary.update(now, 1e9 + i % 10);
+
+    summary_counter_t::summary_t window;
+    summary.get(now, &window);
+    EXPECT_EQ(0, window.count);
+
+    summary.get(now + std::chrono::seconds(10), &window);
+    EXPECT_EQ(1000, window.count);
+    EXPECT_EQ(1e9, window.min);
+    EXPECT_EQ(1e9 + 9, window.max);
+    EXPECT_NEAR(1e9 + 4.5, window.mean, 1e-6);
+    EXPECT_NEAR(2.8737, window.stddev, 1e-4);
+
+    summary.update(now + std::chrono::seconds(10), -1);
+    summary.get(now + std::chrono::seconds(20), &window);
+    EXPECT_EQ(1, window.count);
+    EXPECT_EQ(-1, window.min);
+    EXPECT_EQ(0, window.stddev);
+
+    summary.get(now + std::chrono::seconds(30), &window);
+    EXPECT_EQ(0, window.count);
+
+    EXPECT_EQ(1001, summary.count());
+    EXPECT_EQ(1000 * 1e9 + 4500 - 1, summary.sum());
+}
+
+TEST(space_saving_counter_test_t, exact_while_not_full) {
+    auto now = std::chrono::system_clock::now();
+    space_saving_counter_t c(std::chrono::hours(1000), 10);
+
+    std::hash<std::string> hash;
+    for (int i = 0; i < 5; ++i) {
+        for (int j = 0; j <= i; ++j) {
+            std::string key = "key" + std::to_string(i);
+            c.mark(now, hash(key), key);
+        }
+    }
+
+    std::vector<std::pair<std::string, double>> counts;
+    c.get(now, &counts);
+    std::sort(counts.begin(), counts.end());
+
+    ASSERT_EQ(5u, counts.size());
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ("key" + std::to_string(i), counts[i].first);
+        EXPECT_NEAR(i + 1, counts[i].second, 1e-6);
+    }
+}
+
+TEST(space_saving_counter_test_t, heavy_hitters) {
+    auto now = std::chrono::system_clock::now();
+    space_saving_counter_t c(std::chrono::hours(1000), 40);
+
+    std::default_random_engine generator;
+    std::uniform_int_distribution<int> tail(0, 100000);
+
+    // colliding hashes exercise probing and deletion
+    for (int i = 0; i < 100000; ++i) {
+        std::string key = i % 10 == 0 ? "heavy" + std::to_string(i % 30)
+                                      : "tail" + std::to_string(tail(generator));
+        c.mark(now, key.size(), key);
+    }
+
+    std::vector<std::pair<std::string, double>> counts;
+    c.get(now, &counts);
+    ASSERT_EQ(40u, counts.size());
+
+    std::sort(counts.begin(), counts.end(),
+              [] (const std::pair<std::string, double>& a,
+                  const std::pair<std::string, double>& b) {
+                  return a.second > b.second;
+              });
+
+    std::vector<std::string> top;
+    for (int i = 0; i < 3; ++i) top.push_back(counts[i].first);
+    std::sort(top.begin(), top.end());
+
+    ASSERT_EQ(std::vector<std::string>({"heavy0", "heavy10", "heavy20"}), top);
+    EXPECT_GE(counts[0].second, 100000 / 30);
+}
+
+TEST(space_saving_counter_test_t, decay) {
+    auto now = std::chrono::system_clock::now();
+    space_saving_counter_t c(std::chrono::seconds(1), 2);
+
+    std::hash<std::string> hash;
+    for (int i = 0; i < 1000; ++i) {
+        now += std::chrono::milliseconds(100);
+        c.mark(now, hash("old"), "old");
+    }
+    for (int i = 0; i < 100; ++i) {
+        now += std::chrono::milliseconds(100);
+        c.mark(now, hash("new"), "new");
+    }
+
+    std::vector<std::pair<std::string, double>> counts;
+    c.get(now, &counts);
+    std::sort(counts.begin(), counts.end());
+
+    ASSERT_EQ("new", counts[0].first);
+    EXPECT_NEAR(10., counts[0].second, 1.0);
+    ASSERT_EQ("old", counts[1].first);
+    EXPECT_NEAR(0., counts[1].second, 1e-3);
+}
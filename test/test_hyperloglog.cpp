@@ -0,0 +1,131 @@
+#include <thread>
+
+#include <pm/hyperloglog.h>
+#include <pm/metrics.h>
+#include <pm/graphite.h>
+#include <pm/tree.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+using namespace ::testing;
+using namespace pm;
+
+TEST(hyperloglog_test_t, small_sets_are_sparse) {
+    hyperloglog_t h;
+    EXPECT_EQ(0, h.estimate());
+
+    for (int i = 0; i < 10; ++i) {
+        h.add(i);
+        h.add(i);
+    }
+
+    EXPECT_TRUE(h.sparse());
+    EXPECT_NEAR(10, h.estimate(), 0.5);
+}
+
+TEST(hyperloglog_test_t, large_sets) {
+    for (int n : {1000, 100000, 1000000}) {
+        hyperloglog_t h;
+        for (int i = 0; i < n; ++i) h.add(i);
+
+        EXPECT_FALSE(h.sparse());
+        EXPECT_NEAR(n, h.estimate(), n * 0.05);
+    }
+}
+
+TEST(hyperloglog_test_t, merge) {
+    hyperloglog_t a, b, small;
+    for (int i = 0; i < 50000; ++i) a.add(i);
+    for (int i = 25000; i < 75000; ++i) b.add(i);
+    for (int i = 0; i < 10; ++i) small.add(1000000 + i);
+
+    a.merge(b);
+    EXPECT_NEAR(75000, a.estimate(), 75000 * 0.05);
+
+    small.merge(a);
+    EXPECT_FALSE(small.sparse());
+    EXPECT_NEAR(75010, small.estimate(), 75010 * 0.05);
+}
+
+TEST(hyperloglog_test_t, serialize) {
+    for (int n : {10, 10000}) {
+        hyperloglog_t h;
+        for (int i = 0; i < n; ++i) h.add(i);
+
+        hyperloglog_t copy;
+        ASSERT_TRUE(copy.deserialize(h.serialize()));
+        EXPECT_EQ(h.sparse(), copy.sparse());
+        EXPECT_EQ(h.estimate(), copy.estimate());
+    }
+
+    hyperloglog_t h;
+    h.add(1);
+    std::string data = h.serialize();
+
+    EXPECT_FALSE(h.deserialize(""));
+    EXPECT_FALSE(h.deserialize(data.substr(0, data.size() - 1)));
+    EXPECT_FALSE(h.deserialize("X" + data.substr(1)));
+    EXPECT_TRUE(h.sparse());
+    EXPECT_EQ(0, h.estimate());
+}
+
+TEST(cardinality_counter_test_t, windows) {
+    cardinality_counter_t c(std::chrono::seconds(10));
+    auto now = time_point_t(std::chrono::system_clock::now());
+
+    for (int i = 0; i < 10000; ++i) c.add(now, i % 5000);
+
+    hyperloglog_t h;
+    c.get(now, &h);
+    EXPECT_EQ(0, h.estimate());
+
+    now += std::chrono::seconds(10);
+    for (int i = 0; i < 20; ++i) c.add(now, i);
+
+    c.get(now, &h);
+    EXPECT_NEAR(5000, h.estimate(), 5000 * 0.05);
+
+    now += std::chrono::seconds(10);
+    c.get(now, &h);
+    EXPECT_TRUE(h.sparse());
+    EXPECT_NEAR(20, h.estimate(), 0.5);
+
+    // idle for more than a window
+    now += std::chrono::seconds(25);
+    c.get(now, &h);
+    EXPECT_EQ(0, h.estimate());
+}
+
+TEST(cardinality_counter_test_t, many_threads) {
+    cardinality_counter_t c(std::chrono::seconds(10));
+    auto now = time_point_t(std::chrono::system_clock::now());
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&c, now, t] {
+            for (int i = 0; i < 50000; ++i) c.add(now, t * 25000 + i);
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    hyperloglog_t h;
+    c.get(now + std::chrono::seconds(10), &h);
+    EXPECT_NEAR(125000, h.estimate(), 125000 * 0.05);
+}
+
+TEST(cardinality_test_t, print) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+    cardinality_t users = registry.cardinality("users");
+
+    users.add("alice");
+    users.add("bob");
+    users.add(42);
+
+    // nothing is reported until the first minute is complete
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+    EXPECT_EQ("g.users 0 100\n", p.result());
+
+    cardinality_t().add("nobody");
+}
@@ -0,0 +1,126 @@
+#include <pm/json.h>
+
+#include <cstdio>
+
+#include <gtest/gtest.h>
+
+using namespace pm;
+
+TEST(json_printer_test_t, empty) {
+    json_printer_t p;
+
+    ASSERT_EQ("", p.result());
+
+    p.start_node();
+    p.end_node();
+
+    ASSERT_EQ("{}\n", p.result());
+}
+
+TEST(json_printer_test_t, simple) {
+    json_printer_t p;
+
+    p.start_node();
+
+    p.child("foo");
+    p.value((int64_t)10);
+
+    p.child("bar");
+    p.start_node();
+    p.child("value.value");
+    p.value(0.5);
+    p.child("neg");
+    p.value((int64_t)-7);
+    p.end_node();
+
+    p.end_node();
+
+    ASSERT_EQ("{\"foo\":10,\"bar\":{\"value.value\":0.5,\"neg\":-7}}\n",
+              p.result());
+}
+
+TEST(json_printer_test_t, escaping) {
+    json_printer_t p;
+
+    p.start_node();
+    p.child("a\"b\\c\nd\x01");
+    p.value((uint64_t)1);
+    p.end_node();
+
+    ASSERT_EQ("{\"a\\\"b\\\\c\\nd\\u0001\":1}\n", p.result());
+}
+
+TEST(json_printer_test_t, numbers) {
+    json_printer_t p;
+
+    p.start_node();
+    p.child("a");
+    p.value(0.0);
+    p.child("b");
+    p.value(-1.25);
+    p.child("c");
+    p.value(0.0125);
+    p.child("d");
+    p.value(1e20);
+    p.child("e");
+    p.value(1.0 / 0.0);
+    p.child("f");
+    p.value(42.0);
+    p.child("g");
+    p.value(0.00005);
+    // more digits than the fast path prints
+    p.child("h");
+    p.value(0.0012345678);
+    p.child("i");
+    p.value(123.456789012);
+    // needs all 17 digits to read back the same
+    p.child("j");
+    p.value(0.1 + 0.2);
+    p.end_node();
+
+    ASSERT_EQ(
+        "{\"a\":0,\"b\":-1.25,\"c\":0.0125,\"d\":1e+20,\"e\":null,"
+        "\"f\":42,\"g\":0.00005,\"h\":0.0012345678,\"i\":123.456789012,"
+        "\"j\":0.30000000000000004}\n",
+        p.result());
+}
+
+TEST(json_printer_test_t, clear_and_reuse) {
+    json_printer_t p;
+
+    p.start_node();
+    p.child("a");
+    p.value((int64_t)1);
+    p.end_node();
+
+    p.clear();
+
+    p.start_node();
+    p.child("b");
+    p.value((int64_t)2);
+    p.end_node();
+
+    ASSERT_EQ("{\"b\":2}\n", p.result());
+}
+
+TEST(json_printer_test_t, file_descriptor) {
+    FILE* file = tmpfile();
+    ASSERT_TRUE(file);
+
+    {
+        json_printer_t p(fileno(file));
+        p.start_node();
+        p.child("a");
+        p.value((int64_t)1);
+        p.end_node();
+
+        ASSERT_EQ("", p.result());
+    }
+
+    char buffer[64] = {};
+    rewind(file);
+    ASSERT_EQ(8u, fread(buffer, 1, sizeof(buffer), file));
+    ASSERT_EQ(std::string("{\"a\":1}\n"), buffer);
+
+    fclose(file);
+}
@@ -1,5 +1,14 @@
 #include <pm/metrics.h>
 #include <pm/graphite.h>
+#include <pm/tree.h>
+#include <pm/quantile.h>
+#include <pm/self.h>
+
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
@@ -74,6 +83,14 @@ TEST(metrics_test_t, timer) {
         "g.test.timer.timings.q90 " + FLOAT_RE + " 100\n"
         "g.test.timer.timings.q95 " + FLOAT_RE + " 100\n"
         "g.test.timer.timings.q99 " + FLOAT_RE + " 100\n"
+        "g.test.timer.timings.count " + FLOAT_RE + " 100\n"
+        "g.test.timer.timings.sum " + FLOAT_RE + " 100\n"
+        "g.test.timer.timings.min " + FLOAT_RE + " 100\n"
+        "g.test.timer.timings.max " + FLOAT_RE + " 100\n"
+        "g.test.timer.timings.mean " + FLOAT_RE + " 100\n"
+        "g.test.timer.timings.stddev " + FLOAT_RE + " 100\n"
+        "g.test.timer.timings.underflow 0 100\n"
+        "g.test.timer.timings.overflow 0 100\n"
     ));
 
     token.finish();
@@ -92,5 +109,348 @@ TEST(metrics_test_t, timer) {
         "g.test.timer.timings.q90 " + FLOAT_RE + " 100\n"
         "g.test.timer.timings.q95 " + FLOAT_RE + " 100\n"
         "g.test.timer.timings.q99 " + FLOAT_RE + " 100\n"
+        "g.test.timer.timings.count " + FLOAT_RE + " 100\n"
+        "g.test.timer.timings.sum " + FLOAT_RE + " 100\n"
+        "g.test.timer.timings.min " + FLOAT_RE + " 100\n"
+        "g.test.timer.timings.max " + FLOAT_RE + " 100\n"
+        "g.test.timer.timings.mean " + FLOAT_RE + " 100\n"
+        "g.test.timer.timings.stddev " + FLOAT_RE + " 100\n"
+        "g.test.timer.timings.underflow 0 100\n"
+        "g.test.timer.timings.overflow 0 100\n"
+    ));
+}
+
+TEST(metrics_test_t, histogram_reports_out_of_range_values) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+    histogram_t h = registry.histogram("h", 0, 100);
+
+    h.update(-1);
+    for (int i = 0; i < 10; ++i) h.update(50);
+    h.update(1000);
+    h.update(2000);
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+
+    EXPECT_THAT(p.result(), HasSubstr(
+        "g.h.underflow 1 100\n"
+        "g.h.overflow 2 100\n"));
+}
+
+TEST(metrics_test_t, auto_histogram) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+    histogram_t h = registry.histogram("h");
+
+    for (int i = 0; i < 98; ++i) h.update(10);
+    h.update(1000000);
+    h.update(1000000);
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+
+    EXPECT_THAT(p.result(), MatchesRegex(
+        "g.h.q50 10.[0-9]+ 100\n"
+        "g.h.q80 10.[0-9]+ 100\n"
+        "g.h.q90 10.[0-9]+ 100\n"
+        "g.h.q95 10.[0-9]+ 100\n"
+        "g.h.q99 1.0[0-9]+e\\+06 100\n"
+        "g.h.count 100 100\n"
+        "g.h.sum 2.00098e\\+06 100\n"
+        "g.h.min " + FLOAT_RE + " 100\n"
+        "g.h.max " + FLOAT_RE + " 100\n"
+        "g.h.mean " + FLOAT_RE + " 100\n"
+        "g.h.stddev " + FLOAT_RE + " 100\n"
+        "g.h.underflow 0 100\n"
+        "g.h.overflow 0 100\n"
     ));
 }
+
+TEST(metrics_test_t, configurable_quantiles) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+    histogram_t h = registry.histogram("h", 0, 100, {.999, .05, .5});
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+
+    EXPECT_THAT(p.result(), StartsWith(
+        "g.h.q05 0 100\n"
+        "g.h.q50 0 100\n"
+        "g.h.q999 0 100\n"
+        "g.h.count 0 100\n"));
+}
+
+TEST(metrics_test_t, quantiles_are_validated) {
+    quantiles_t q({.9999995, .99, .5, .99, 1, .05});
+    EXPECT_EQ(std::vector<double>({.05, .5, .99, .9999995, 1}), q.values);
+    EXPECT_EQ(std::vector<std::string>({"q05", "q50", "q99", "q9999995", "q100"}),
+              q.names);
+
+    // close values get distinct names
+    EXPECT_EQ(std::vector<std::string>({"q1234561", "q1234562"}),
+              quantiles_t({.1234561, .1234562}).names);
+
+    registry_t registry(std::make_shared<tree_branch_t>());
+    EXPECT_THROW(registry.histogram("h", {.5, 0}), std::invalid_argument);
+    EXPECT_THROW(registry.histogram("h", 0, 10, {-.5}), std::invalid_argument);
+    EXPECT_THROW(registry.timer("t", {1.5}), std::invalid_argument);
+    EXPECT_THROW(registry.timer("t", {std::nan("")}), std::invalid_argument);
+}
+
+TEST(metrics_test_t, refs) {
+    static_assert(std::is_trivially_copyable<counter_ref_t>::value, "");
+    static_assert(std::is_trivially_copyable<meter_ref_t>::value, "");
+    static_assert(std::is_trivially_copyable<histogram_ref_t>::value, "");
+    static_assert(std::is_trivially_copyable<timer_ref_t>::value, "");
+
+    registry_t registry(std::make_shared<tree_branch_t>());
+
+    // refs don't keep metrics alive, the branch does
+    counter_ref_t counter = registry.counter_ref("counter");
+    counter_ref_t copy = counter;
+    copy.inc(5);
+    counter.dec(2);
+    registry.meter_ref("meter");
+    registry.histogram_ref("hist", 0, 100).update(10);
+    registry.timer_ref("timer").update(20);
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+    EXPECT_THAT(p.result(), StartsWith("g.counter 3 100\n"));
+    EXPECT_THAT(p.result(), HasSubstr("g.hist.count 1 100\n"));
+    EXPECT_THAT(p.result(), HasSubstr("g.meter.one_sec 0 100\n"));
+    EXPECT_THAT(p.result(), HasSubstr("g.timer.timings.sum 20 100\n"));
+
+    // default constructed refs and refs of detached registries go nowhere
+    counter_ref_t sink;
+    sink.inc();
+    registry_t(nullptr).counter_ref("counter").inc();
+    timer_ref_t timer;
+    timer.finish(timer.start());
+    meter_ref_t().mark();
+    histogram_ref_t().update(1);
+}
+
+TEST(metrics_test_t, refs_registered_again) {
+    auto root = std::make_shared<tree_branch_t>();
+    registry_t registry(root);
+    self_stats_t& stats = self_stats();
+    int64_t live = stats.live[COUNTER_METRIC].load();
+
+    // the same name and type gives the same metric
+    counter_ref_t first = registry.counter_ref("counter");
+    counter_ref_t counter = registry.counter_ref("counter");
+    first.inc(5);
+    counter.inc();
+    for (int i = 0; i < 100; ++i) registry.counter_ref("other");
+    EXPECT_EQ(2u, root->size());
+    EXPECT_EQ(live + 2, stats.live[COUNTER_METRIC].load());
+
+    // another type replaces the metric, old refs update an unexported one
+    counter_ref_t old = registry.counter_ref("other");
+    registry.meter_ref("other");
+    old.inc();
+
+    // so do refs into a branch replaced by a leaf
+    counter_ref_t nested = registry.subtree("a").counter_ref("x");
+    timer_ref_t timer = registry.subtree("a").timer_ref("t");
+    time_point_t start = timer.start();
+    pm::counter_t a = registry.counter("a");
+    nested.inc();
+    timer.finish(start);
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+    EXPECT_THAT(p.result(), StartsWith("g.a 0 100\ng.counter 6 100\ng.other.one_sec 0 100\n"));
+
+    // replaced metrics are freed with the tree only
+    a = pm::counter_t();
+    EXPECT_EQ(live + 3, stats.live[COUNTER_METRIC].load());
+    registry = registry_t();
+    root.reset();
+    EXPECT_EQ(live, stats.live[COUNTER_METRIC].load());
+}
+
+TEST(metrics_test_t, refs_replaced_concurrently) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+
+    std::vector<counter_ref_t> counters;
+    for (int i = 0; i < 16; ++i) {
+        counters.push_back(registry.counter_ref("c" + std::to_string(i)));
+    }
+
+    // metrics are replaced while other threads update them
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&stop, counters] () mutable {
+            while (!stop) {
+                for (auto& counter : counters) counter.inc();
+            }
+        });
+    }
+    for (int j = 0; j < 50; ++j) {
+        for (int i = 0; i < 16; ++i) {
+            std::string name = "c" + std::to_string(i);
+            if (j % 2) {
+                registry.counter_ref(name);
+            } else {
+                registry.meter_ref(name);
+            }
+        }
+    }
+    stop = true;
+    for (auto& t : threads) t.join();
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+    EXPECT_THAT(p.result(), MatchesRegex("(g.c[0-9]+ 0 100\n){16}"));
+}
+
+TEST(metrics_test_t, lock_stats) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+    EXPECT_FALSE(lock_stats_enabled());
+    lock_stats_t stats = registry.lock_stats("locks");
+    EXPECT_TRUE(lock_stats_enabled());
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+
+    EXPECT_THAT(p.result(), MatchesRegex(
+        "g.locks.double_buffer_counter.contended [0-9.e+]+ 100\n"
+        "g.locks.double_buffer_counter.spins [0-9.e+]+ 100\n"
+        "g.locks.double_buffer_counter.yields [0-9.e+]+ 100\n"
+        "g.locks.decaying_counter.contended [0-9.e+]+ 100\n"
+        "g.locks.decaying_counter.spins [0-9.e+]+ 100\n"
+        "g.locks.decaying_counter.yields [0-9.e+]+ 100\n"
+        "g.locks.space_saving_counter.contended [0-9.e+]+ 100\n"
+        "g.locks.space_saving_counter.spins [0-9.e+]+ 100\n"
+        "g.locks.space_saving_counter.yields [0-9.e+]+ 100\n"));
+
+    stats = lock_stats_t();
+    EXPECT_FALSE(lock_stats_enabled());
+}
+
+TEST(metrics_test_t, self_stats) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+    self_stats_t& stats = self_stats();
+
+    int64_t live = stats.live[TIMER_METRIC].load();
+    int64_t impl_bytes = stats.impl_bytes.load();
+    int64_t tree_bytes = stats.tree_bytes.load();
+    uint64_t registrations = stats.registrations.load();
+
+    {
+        pm::timer_t t = registry.subtree("sub").timer("timer");
+        EXPECT_EQ(live + 1, stats.live[TIMER_METRIC].load());
+        EXPECT_GT(stats.impl_bytes.load(), impl_bytes);
+        EXPECT_GT(stats.tree_bytes.load(), tree_bytes);
+        EXPECT_EQ(registrations + 1, stats.registrations.load());
+    }
+
+    EXPECT_EQ(live, stats.live[TIMER_METRIC].load());
+    EXPECT_EQ(impl_bytes, stats.impl_bytes.load());
+
+    // dead nodes are freed by print
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+    EXPECT_EQ(tree_bytes, stats.tree_bytes.load());
+}
+
+TEST(metrics_test_t, self_metrics) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+    self_metrics_t self = registry.self_metrics("pmetrics");
+
+    std::string NUMBER_RE = "[0-9.e+-]+";
+    for (int i = 0; i < 2; ++i) {
+        graphite_printer_t p("g", 100);
+        registry.print(&p);
+
+        EXPECT_THAT(p.result(), MatchesRegex(
+            "g.pmetrics.live.counter " + NUMBER_RE + " 100\n"
+            "g.pmetrics.live.monotonic_counter " + NUMBER_RE + " 100\n"
+            "g.pmetrics.live.meter " + NUMBER_RE + " 100\n"
+            "g.pmetrics.live.histogram " + NUMBER_RE + " 100\n"
+            "g.pmetrics.live.timer " + NUMBER_RE + " 100\n"
+            "g.pmetrics.live.top_k " + NUMBER_RE + " 100\n"
+            "g.pmetrics.live.cardinality " + NUMBER_RE + " 100\n"
+            "g.pmetrics.memory.impl_bytes " + NUMBER_RE + " 100\n"
+            "g.pmetrics.memory.tree_bytes " + NUMBER_RE + " 100\n"
+            "g.pmetrics.registrations.count " + NUMBER_RE + " 100\n"
+            "g.pmetrics.registrations.one_min " + NUMBER_RE + " 100\n"
+            "g.pmetrics.print.count " + NUMBER_RE + " 100\n"
+            "g.pmetrics.print.last_ms " + NUMBER_RE + " 100\n"
+            "g.pmetrics.print.total_ms " + NUMBER_RE + " 100\n"
+            "g.pmetrics.print.graphite_bytes " + NUMBER_RE + " 100\n"
+            "g.pmetrics.tree_lock.waits " + NUMBER_RE + " 100\n"
+            "g.pmetrics.tree_lock.wait_ms " + NUMBER_RE + " 100\n"));
+    }
+
+    // 60 registrations just now are one per second over the last minute
+    std::vector<counter_t> counters;
+    for (int i = 0; i < 60; ++i) {
+        counters.push_back(registry.subtree("c").counter(std::to_string(i)));
+    }
+    {
+        graphite_printer_t p("g", 100);
+        registry.print(&p);
+        EXPECT_THAT(p.result(), HasSubstr("g.pmetrics.registrations.one_min 1 100\n"));
+    }
+
+    uint64_t bytes = self_stats().graphite_bytes.load();
+    {
+        graphite_printer_t p("g", 100);
+        registry.print(&p);
+        bytes += p.result().size();
+    }
+    EXPECT_EQ(bytes, self_stats().graphite_bytes.load());
+
+    // nothing timed or counted without a handle
+    self = self_metrics_t();
+    EXPECT_FALSE(self_stats().enabled());
+    uint64_t prints = self_stats().prints.load();
+    {
+        graphite_printer_t p("g", 100);
+        registry.print(&p);
+    }
+    EXPECT_EQ(prints, self_stats().prints.load());
+    EXPECT_EQ(bytes, self_stats().graphite_bytes.load());
+}
+
+TEST(metrics_test_t, top_k) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+    top_k_t top = registry.top_k("top", 2);
+
+    for (int i = 0; i < 3; ++i) top.mark("a.b");
+    for (int i = 0; i < 2; ++i) top.mark("c");
+    top.mark("d");
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+
+    EXPECT_THAT(p.result(), MatchesRegex(
+        "g.top.a_b " + FLOAT_RE + " 100\n"
+        "g.top.c " + FLOAT_RE + " 100\n"
+    ));
+}
+
+TEST(metrics_test_t, top_k_keys_are_sanitized) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+    top_k_t top = registry.top_k("top", 2);
+
+    for (int i = 0; i < 3; ++i) top.mark("x\ny");
+    for (int i = 0; i < 3; ++i) top.mark("x y");
+    for (int i = 0; i < 5; ++i) top.mark("");
+    top.mark("z");
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+
+    // "x\ny" and "x y" are counted together
+    EXPECT_THAT(p.result(), MatchesRegex(
+        "g.top.x_y 0.1 100\n"
+        "g.top._ 0.08[0-9]+ 100\n"
+    ));
+
+    EXPECT_THROW(registry.top_k("top", 0), std::invalid_argument);
+    EXPECT_THROW(registry.top_k("top", -1), std::invalid_argument);
+}
@@ -0,0 +1,273 @@
+#include <pm/policy.h>
+#include <pm/graphite.h>
+#include <pm/self.h>
+
+#include <map>
+#include <sstream>
+#include <thread>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+using namespace ::testing;
+using namespace pm;
+
+static const std::string FLOAT_RE = "[0-9]+(.[0-9]+)?";
+
+template <class policy_t>
+struct policy_test_t : public testing::Test {
+    policy_test_t() : registry(std::make_shared<tree_branch_t>()) {}
+
+    std::string print() {
+        graphite_printer_t p("g", 100);
+        registry.print(&p);
+        return p.result();
+    }
+
+    registry_t registry;
+};
+
+typedef Types<relaxed_policy_t, striped_policy_t, thread_local_policy_t,
+              plain_policy_t> enabled_policies_t;
+TYPED_TEST_CASE(policy_test_t, enabled_policies_t);
+
+TYPED_TEST(policy_test_t, default_constructed_metrics_do_nothing) {
+    basic_counter_t<TypeParam> counter;
+    counter.inc();
+    counter.dec();
+
+    basic_meter_t<TypeParam> meter;
+    meter.mark();
+
+    basic_histogram_t<TypeParam> hist;
+    hist.update(10);
+
+    basic_timer_t<TypeParam> timer;
+    timer.finish(timer.start());
+
+    ASSERT_EQ("", this->print());
+}
+
+TYPED_TEST(policy_test_t, counter) {
+    auto c = this->registry.subtree("test").template counter<TypeParam>("counter");
+
+    c.inc(10);
+    c.dec(3);
+
+    ASSERT_EQ("g.test.counter 7 100\n", this->print());
+}
+
+TYPED_TEST(policy_test_t, counter_from_many_threads) {
+    auto c = this->registry.template counter<TypeParam>("counter");
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([c] () mutable {
+            for (int j = 0; j < 100000; ++j) c.inc();
+        });
+    }
+
+    // plain policy loses concurrent updates, only check it doesn't crash
+    for (auto& t : threads) t.join();
+    if (std::is_same<TypeParam, plain_policy_t>::value) return;
+
+    ASSERT_EQ("g.counter 400000 100\n", this->print());
+}
+
+TYPED_TEST(policy_test_t, impls_are_tracked) {
+    self_stats_t& stats = self_stats();
+    int64_t counters = stats.live[COUNTER_METRIC].load();
+    int64_t timers = stats.live[TIMER_METRIC].load();
+    int64_t impl_bytes = stats.impl_bytes.load();
+
+    {
+        auto c = this->registry.template counter<TypeParam>("counter");
+        auto t = this->registry.template timer<TypeParam>("timer");
+        EXPECT_EQ(counters + 1, stats.live[COUNTER_METRIC].load());
+        EXPECT_EQ(timers + 1, stats.live[TIMER_METRIC].load());
+        EXPECT_GT(stats.impl_bytes.load(), impl_bytes);
+    }
+
+    EXPECT_EQ(counters, stats.live[COUNTER_METRIC].load());
+    EXPECT_EQ(timers, stats.live[TIMER_METRIC].load());
+    EXPECT_EQ(impl_bytes, stats.impl_bytes.load());
+}
+
+// graphite output at a given time, parsed into path -> value
+struct timed_printer_t : public graphite_printer_t {
+    explicit timed_printer_t(time_point_t time)
+        : graphite_printer_t("g", 100), time(time) {}
+
+    virtual time_point_t now() { return time; }
+
+    std::map<std::string, double> values() const {
+        std::map<std::string, double> values;
+        std::istringstream lines(result());
+        std::string name;
+        double value;
+        int64_t timestamp;
+        while (lines >> name >> value >> timestamp) values[name] = value;
+        return values;
+    }
+
+    time_point_t time;
+};
+
+TYPED_TEST(policy_test_t, meter_histogram_timer) {
+    auto m = this->registry.template meter<TypeParam>("meter");
+    auto h = this->registry.template histogram<TypeParam>("hist", 0, 100);
+    auto t = this->registry.template timer<TypeParam>("timer");
+
+    m.mark();
+    for (int i = 0; i < 100; ++i) h.update(i);
+    h.update(-1);
+    t.start();
+    for (int i = 0; i < 10; ++i) t.update(5000);
+
+    auto hist_re = [] (const std::string& prefix) {
+        std::string re;
+        for (const char* child : {"q50", "q80", "q90", "q95", "q99", "count",
+                                  "sum", "min", "max", "mean", "stddev",
+                                  "underflow", "overflow"}) {
+            re += prefix + child + " " + FLOAT_RE + " 100\n";
+        }
+        return re;
+    };
+
+    EXPECT_THAT(this->print(), MatchesRegex(
+        hist_re("g.hist.") +
+        "g.meter.one_sec " + FLOAT_RE + " 100\n"
+        "g.meter.one_min " + FLOAT_RE + " 100\n"
+        "g.meter.quarter_hour " + FLOAT_RE + " 100\n"
+        "g.meter.one_hour " + FLOAT_RE + " 100\n"
+        "g.timer.active 1 100\n"
+        "g.timer.rate.one_sec " + FLOAT_RE + " 100\n"
+        "g.timer.rate.one_min " + FLOAT_RE + " 100\n"
+        "g.timer.rate.quarter_hour " + FLOAT_RE + " 100\n"
+        "g.timer.rate.one_hour " + FLOAT_RE + " 100\n" +
+        hist_re("g.timer.timings.")
+    ));
+
+    std::string result = this->print();
+    EXPECT_THAT(result, ContainsRegex("g.hist.q50 (49|50).[0-9]+ 100\n"));
+    EXPECT_THAT(result, HasSubstr("g.hist.count 101 100\n"));
+    EXPECT_THAT(result, HasSubstr("g.hist.sum 4949 100\n"));
+    EXPECT_THAT(result, HasSubstr("g.hist.underflow 1 100\n"));
+
+    // timers don't clamp long durations
+    EXPECT_THAT(result, HasSubstr("g.timer.timings.sum 50000 100\n"));
+    EXPECT_THAT(result, ContainsRegex("g.timer.timings.q99 5[0-9]+ 100\n"));
+}
+
+TYPED_TEST(policy_test_t, same_export_as_pimpl_histogram) {
+    auto policy_hist = this->registry.template histogram<TypeParam>("policy", {.5, .999});
+    histogram_t hist = this->registry.histogram("pimpl", {.5, .999});
+
+    for (int i = 1; i <= 1000; ++i) {
+        policy_hist.update(i * 1000);
+        hist.update(i * 1000);
+    }
+
+    // policy histogram takes values in at print, summaries cover the
+    // previous minute
+    auto now = time_point_t(std::chrono::system_clock::now());
+    timed_printer_t first(now);
+    this->registry.print(&first);
+
+    timed_printer_t p(now + std::chrono::minutes(1));
+    this->registry.print(&p);
+    auto values = p.values();
+
+    for (const char* child : {"q50", "q999", "count", "sum", "min", "max", "mean",
+                              "stddev", "underflow", "overflow"}) {
+        double expected = values[std::string("g.pimpl.") + child];
+        EXPECT_NEAR(expected, values[std::string("g.policy.") + child],
+                    expected * 0.02 + 1e-9) << child;
+    }
+}
+
+TYPED_TEST(policy_test_t, meter_matches_meter_t) {
+    auto policy_meter = this->registry.template meter<TypeParam>("policy");
+    meter_t meter = this->registry.meter("pimpl");
+
+    auto start = time_point_t(std::chrono::system_clock::now());
+    for (int i = 0; i < 3000; ++i) {
+        policy_meter.mark();
+        meter.mark();
+    }
+
+    // marks of the first second are reported during the next one, then
+    // rates drop to zero
+    for (int ms : {1010, 2100}) {
+        timed_printer_t p(start + std::chrono::milliseconds(ms));
+        this->registry.print(&p);
+        auto values = p.values();
+
+        for (const char* rate : {"one_sec", "one_min", "quarter_hour", "one_hour"}) {
+            double expected = values[std::string("g.pimpl.") + rate];
+            EXPECT_NEAR(expected, values[std::string("g.policy.") + rate],
+                        expected * 0.02 + 1e-9) << rate << " after " << ms << "ms";
+        }
+    }
+}
+
+TEST(noop_policy_test_t, not_registered) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+
+    auto c = registry.counter<noop_policy_t>("counter");
+    c.inc();
+    registry.meter<noop_policy_t>("meter").mark();
+
+    auto h = registry.histogram<noop_policy_t>("hist");
+    h.update(10);
+
+    // doesn't even read the clock
+    auto t = registry.timer<noop_policy_t>("timer");
+    EXPECT_EQ(time_point_t(), t.start());
+    t.finish(time_point_t());
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+    ASSERT_EQ("", p.result());
+}
+
+TEST(thread_local_policy_test_t, exited_threads_are_counted) {
+    thread_local_policy_t::cell_t cell;
+
+    std::thread([&cell] { cell.add(5); }).join();
+    cell.add(2);
+
+    ASSERT_EQ(7, cell.load());
+}
+
+TEST(thread_local_policy_test_t, overflowed_cells_share_atomic) {
+    size_t overflowed = thread_local_policy_t::overflowed_cells();
+
+    {
+        // sinks of default constructed metrics hold some cells
+        std::vector<std::unique_ptr<thread_local_policy_t::cell_t>> cells;
+        do {
+            cells.emplace_back(new thread_local_policy_t::cell_t());
+        } while (!cells.back()->overflowed());
+
+        auto& last = *cells.back();
+        EXPECT_LE(cells.size(), thread_local_policy_t::MAX_CELLS + 1);
+        EXPECT_EQ(overflowed + 1, thread_local_policy_t::overflowed_cells());
+
+        std::thread([&last] { last.add(5); }).join();
+        last.add(2);
+        EXPECT_EQ(7, last.load());
+    }
+
+    EXPECT_EQ(overflowed, thread_local_policy_t::overflowed_cells());
+}
+
+TEST(thread_local_policy_test_t, released_cells_are_reset) {
+    {
+        thread_local_policy_t::cell_t cell;
+        cell.add(5);
+    }
+
+    thread_local_policy_t::cell_t cell;
+    ASSERT_EQ(0, cell.load());
+}
@@ -0,0 +1,217 @@
+#include <pm/rate.h>
+#include <pm/graphite.h>
+#include <pm/metrics.h>
+#include <pm/snapshot.h>
+
+#include <sstream>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+using namespace pm;
+
+// graphite output at a given time
+struct timed_printer_t : public graphite_printer_t {
+    timed_printer_t(int64_t seconds)
+        : graphite_printer_t("g", seconds),
+          time(std::chrono::system_clock::from_time_t(seconds)) {}
+
+    virtual time_point_t now() { return time; }
+
+    time_point_t time;
+};
+
+// drives rate_printer_t with a single monotonic value
+struct rate_test_t : public testing::Test {
+    std::string print(int64_t seconds, uint64_t total) {
+        timed_printer_t printer(seconds);
+        rates.reset(&printer);
+
+        rates.start_node();
+        rates.child("c");
+        rates.monotonic(total);
+        rates.end_node();
+
+        return printer.result();
+    }
+
+    rate_printer_t rates;
+};
+
+TEST_F(rate_test_t, delta_and_rate) {
+    EXPECT_EQ(
+        "g.c.total 100 100\n"
+        "g.c.delta 0 100\n"
+        "g.c.rate 0 100\n", print(100, 100));
+
+    EXPECT_EQ(
+        "g.c.total 400 110\n"
+        "g.c.delta 300 110\n"
+        "g.c.rate 30 110\n", print(110, 400));
+
+    EXPECT_EQ(
+        "g.c.total 400 120\n"
+        "g.c.delta 0 120\n"
+        "g.c.rate 0 120\n", print(120, 400));
+}
+
+TEST_F(rate_test_t, reset_and_wraparound) {
+    print(100, 1000);
+
+    // process restarted, counting from zero again
+    EXPECT_EQ(
+        "g.c.total 20 110\n"
+        "g.c.delta 20 110\n"
+        "g.c.rate 2 110\n", print(110, 20));
+
+    print(120, ~uint64_t(0) - 9);
+
+    // total went past 2^64
+    EXPECT_EQ(
+        "g.c.total 10 130\n"
+        "g.c.delta 20 130\n"
+        "g.c.rate 2 130\n", print(130, 10));
+}
+
+TEST_F(rate_test_t, forgets_missing_paths) {
+    print(100, 100);
+
+    // "c" is missing in this pass
+    timed_printer_t printer(110);
+    rates.reset(&printer);
+    rates.start_node();
+    rates.child("other");
+    rates.value(int64_t(1));
+    rates.end_node();
+
+    EXPECT_EQ(
+        "g.c.total 500 120\n"
+        "g.c.delta 0 120\n"
+        "g.c.rate 0 120\n", print(120, 500));
+}
+
+// "path value" lines of all passes, unlike graphite_printer_t usable for
+// more than one tree
+struct lines_printer_t : public tree_printer_t {
+    virtual void start_node() {}
+    virtual void end_node() { pop(); }
+
+    virtual void child(const std::string& name) { path.push_back(name); }
+    virtual void value(double value) { add(std::to_string(value)); }
+    virtual void value(int64_t value) { add(std::to_string(value)); }
+
+    virtual time_point_t now() { return time; }
+
+    virtual std::string result() const { return lines; }
+
+    void add(const std::string& value) {
+        for (const auto& name : path) lines += name + ".";
+        lines.back() = ' ';
+        lines += value + "\n";
+        pop();
+    }
+
+    void pop() {
+        if (!path.empty()) path.pop_back();
+    }
+
+    std::vector<std::string> path;
+    std::string lines;
+    time_point_t time;
+};
+
+TEST(rate_printer_test_t, printer_given_to_constructor) {
+    lines_printer_t printer;
+    rate_printer_t rates(&printer);
+
+    auto print = [&printer, &rates] (const std::string& name, uint64_t total) {
+        printer.lines.clear();
+        rates.start_node();
+        rates.child(name);
+        rates.monotonic(total);
+        rates.end_node();
+        return printer.lines;
+    };
+
+    print("c", 100);
+    printer.time += std::chrono::seconds(10);
+    EXPECT_EQ(
+        "c.total 400\n"
+        "c.delta 300\n"
+        "c.rate 30.000000\n", print("c", 400));
+
+    // every pass takes new time and forgets paths missing in the previous one
+    print("other", 1);
+    printer.time += std::chrono::seconds(10);
+    EXPECT_EQ(
+        "c.total 500\n"
+        "c.delta 0\n"
+        "c.rate 0.000000\n", print("c", 500));
+}
+
+TEST(rate_printer_test_t, registry) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+    monotonic_counter_t bytes = registry.subtree("net").monotonic_counter("bytes");
+    counter_t queue = registry.counter("queue");
+
+    bytes.inc(100);
+    queue.set(5);
+
+    // without rate_printer_t only the total is printed
+    graphite_printer_t plain("g", 100);
+    registry.print(&plain);
+    EXPECT_EQ(
+        "g.net.bytes 100 100\n"
+        "g.queue 5 100\n", plain.result());
+
+    // rates of a live registry use time of the printer
+    rate_printer_t rates;
+    timed_printer_t first(100);
+    rates.reset(&first);
+    registry.print(&rates);
+
+    bytes.inc(50);
+
+    timed_printer_t second(105);
+    rates.reset(&second);
+    registry.print(&rates);
+
+    EXPECT_EQ(
+        "g.net.bytes.total 150 105\n"
+        "g.net.bytes.delta 50 105\n"
+        "g.net.bytes.rate 10 105\n"
+        "g.queue 5 105\n", second.result());
+
+    monotonic_counter_t().inc();
+}
+
+TEST(rate_printer_test_t, snapshots_replayed_later) {
+    registry_t registry(std::make_shared<tree_branch_t>());
+    monotonic_counter_t bytes = registry.monotonic_counter("bytes");
+
+    // snapshot keeps the value monotonic and the time it was taken
+    snapshot_t first, second;
+    first.capture(registry);
+    bytes.inc(50);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    second.capture(registry);
+
+    double seconds = std::chrono::duration<double>(second.time() - first.time()).count();
+    std::ostringstream rate;
+    rate << 50 / seconds;
+
+    // printed an hour later, both at the same printer time
+    rate_printer_t rates;
+    for (const snapshot_t* snapshot : {&first, &second}) {
+        timed_printer_t printer(3600);
+        rates.reset(&printer);
+        snapshot->print(&rates);
+
+        if (snapshot == &second) {
+            EXPECT_EQ(
+                "g.bytes.total 50 3600\n"
+                "g.bytes.delta 50 3600\n"
+                "g.bytes.rate " + rate.str() + " 3600\n", printer.result());
+        }
+    }
+}
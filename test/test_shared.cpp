@@ -0,0 +1,211 @@
+#include <pm/shared.h>
+#include <pm/graphite.h>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+using namespace ::testing;
+using namespace pm;
+
+namespace pm {
+
+struct shared_registry_test_access_t {
+    // slot state is the first field, (pid << 2) | 1 means claimed but not
+    // yet published
+    static void claim(shared_registry_t* registry, size_t index, pid_t pid) {
+        auto state = reinterpret_cast<std::atomic<uint64_t>*>(registry->slot(index));
+        state->store((uint64_t(pid) << 2) | 1);
+    }
+};
+
+}  // namespace pm
+
+static const std::string FLOAT_RE = "[0-9]+(.[0-9]+)?(e[-+][0-9]+)?";
+
+TEST(shared_registry_test_t, default_constructed_metrics_do_nothing) {
+    shared_counter_t counter;
+    counter.inc();
+    counter.set(0);
+
+    shared_meter_t meter;
+    meter.mark();
+
+    shared_histogram_t hist;
+    hist.update(10);
+}
+
+TEST(shared_registry_test_t, empty) {
+    shared_registry_t registry(16, 4096);
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+
+    ASSERT_EQ("", p.result());
+}
+
+TEST(shared_registry_test_t, single_process) {
+    shared_registry_t registry(16, 64 * 1024);
+
+    shared_counter_t c = registry.counter("test.counter");
+    c.set(-2);
+    c.inc(10);
+    c.dec(3);
+
+    registry.meter("test.meter").mark();
+    registry.histogram("hist", 0, 100).update(50);
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+
+    EXPECT_THAT(p.result(), MatchesRegex(
+        "g.hist.q50 " + FLOAT_RE + " 100\n"
+        "g.hist.q80 " + FLOAT_RE + " 100\n"
+        "g.hist.q90 " + FLOAT_RE + " 100\n"
+        "g.hist.q95 " + FLOAT_RE + " 100\n"
+        "g.hist.q99 " + FLOAT_RE + " 100\n"
+        "g.test.counter 5 100\n"
+        "g.test.meter.count 1 100\n"
+        "g.test.meter.rate " + FLOAT_RE + " 100\n"
+    ));
+}
+
+TEST(shared_registry_test_t, same_name_returns_same_metric) {
+    shared_registry_t registry(16, 4096);
+
+    registry.counter("c").inc(1);
+    registry.counter("c").inc(2);
+
+    // type mismatch gives no-op metric
+    registry.meter("c").mark();
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+
+    ASSERT_EQ("g.c 3 100\n", p.result());
+}
+
+TEST(shared_registry_test_t, full_region) {
+    shared_registry_t registry(2, 64);
+
+    registry.counter("a").inc();
+    registry.counter("b").inc();
+    registry.counter("c").inc();
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+
+    ASSERT_EQ("g.a 1 100\n", p.result());
+}
+
+TEST(shared_registry_test_t, workers) {
+    shared_registry_t registry;
+
+    shared_counter_t before_fork = registry.counter("requests");
+
+    const int N_WORKERS = 4;
+    std::vector<pid_t> workers;
+    for (int i = 0; i < N_WORKERS; ++i) {
+        pid_t pid = fork();
+        ASSERT_NE(-1, pid);
+
+        if (pid == 0) {
+            shared_counter_t after_fork = registry.counter("late.counter");
+            shared_histogram_t hist = registry.histogram("late.hist", 0, 100);
+            for (int j = 0; j < 1000; ++j) {
+                before_fork.inc();
+                after_fork.inc();
+                hist.update(j % 100);
+            }
+            _exit(0);
+        }
+
+        workers.push_back(pid);
+    }
+
+    for (pid_t pid : workers) {
+        int status;
+        ASSERT_EQ(pid, waitpid(pid, &status, 0));
+        ASSERT_TRUE(WIFEXITED(status));
+    }
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+
+    EXPECT_THAT(p.result(), MatchesRegex(
+        "g.late.counter 4000 100\n"
+        "g.late.hist.q50 " + FLOAT_RE + " 100\n"
+        "g.late.hist.q80 " + FLOAT_RE + " 100\n"
+        "g.late.hist.q90 " + FLOAT_RE + " 100\n"
+        "g.late.hist.q95 " + FLOAT_RE + " 100\n"
+        "g.late.hist.q99 " + FLOAT_RE + " 100\n"
+        "g.requests 4000 100\n"
+    ));
+}
+
+TEST(shared_registry_test_t, crashed_worker) {
+    shared_registry_t registry;
+
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+
+    if (pid == 0) {
+        shared_counter_t c = registry.counter("crashed");
+        while (true) {
+            c.inc();
+            registry.counter("crashed").inc();
+        }
+    }
+
+    usleep(10000);
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+
+    registry.counter("alive").inc();
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+
+    EXPECT_THAT(p.result(), MatchesRegex(
+        "g.alive 1 100\n"
+        "g.crashed [0-9]+ 100\n"
+    ));
+}
+
+TEST(shared_registry_test_t, slot_claimed_by_dead_process) {
+    shared_registry_t registry(1, 4096);
+
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) _exit(0);
+    ASSERT_EQ(pid, waitpid(pid, nullptr, 0));
+
+    // the only slot was claimed by a process that died before publishing
+    shared_registry_test_access_t::claim(&registry, 0, pid);
+
+    registry.counter("taken_over").inc();
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+
+    EXPECT_EQ("g.taken_over 1 100\n", p.result());
+}
+
+TEST(shared_registry_test_t, slot_claimed_by_reused_pid) {
+    shared_registry_t registry(1, 4096);
+
+    // owner died and its pid went to a process that is still running
+    shared_registry_test_access_t::claim(&registry, 0, getppid());
+
+    auto start = std::chrono::steady_clock::now();
+    registry.counter("taken_over").inc();
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+
+    graphite_printer_t p("g", 100);
+    registry.print(&p);
+
+    EXPECT_EQ("g.taken_over 1 100\n", p.result());
+}
@@ -0,0 +1,85 @@
+#include <pm/snapshot.h>
+#include <pm/graphite.h>
+#include <pm/json.h>
+
+#include <gtest/gtest.h>
+
+using namespace pm;
+
+struct snapshot_test_t : public testing::Test {
+    snapshot_test_t() : registry(std::make_shared<tree_branch_t>()) {}
+
+    registry_t registry;
+    snapshot_t snapshot;
+};
+
+TEST_F(snapshot_test_t, empty) {
+    snapshot.capture(registry);
+
+    graphite_printer_t graphite("g", 100);
+    snapshot.print(&graphite);
+    ASSERT_EQ("", graphite.result());
+
+    json_printer_t json;
+    snapshot.print(&json);
+    ASSERT_EQ("{}\n", json.result());
+}
+
+TEST_F(snapshot_test_t, same_as_registry) {
+    counter_t c = registry.subtree("foo").counter("c");
+    meter_t m = registry.meter("m");
+    histogram_t h = registry.histogram("h", 0, 100);
+
+    c.set(10);
+    m.mark();
+    h.update(50);
+
+    snapshot.capture(registry);
+
+    graphite_printer_t from_snapshot("g", 100);
+    snapshot.print(&from_snapshot);
+
+    // meters decay slightly between prints, compare structure and counters
+    graphite_printer_t from_registry("g", 100);
+    registry.print(&from_registry);
+
+    auto names = [] (const std::string& result) {
+        std::string names;
+        std::istringstream lines(result);
+        for (std::string line; std::getline(lines, line);) {
+            names += line.substr(0, line.find(' ')) + "\n";
+        }
+        return names;
+    };
+
+    ASSERT_EQ(names(from_registry.result()), names(from_snapshot.result()));
+    ASSERT_NE(std::string::npos, from_snapshot.result().find("g.foo.c 10 100\n"));
+}
+
+TEST_F(snapshot_test_t, printers_see_same_values) {
+    meter_t m = registry.meter("m");
+    m.mark();
+
+    snapshot.capture(registry);
+
+    graphite_printer_t first("g", 100), second("g", 100);
+    snapshot.print(&first);
+    snapshot.print(&second);
+
+    ASSERT_EQ(first.result(), second.result());
+}
+
+TEST_F(snapshot_test_t, capture_replaces_previous_values) {
+    counter_t a = registry.counter("a");
+
+    a.set(1);
+    snapshot.capture(registry);
+
+    a.set(2);
+    counter_t b = registry.counter("b");
+    snapshot.capture(registry);
+
+    json_printer_t json;
+    snapshot.print(&json);
+    ASSERT_EQ("{\"a\":2,\"b\":0}\n", json.result());
+}
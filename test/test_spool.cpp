@@ -0,0 +1,201 @@
+#include <pm/spool.h>
+#include <pm/graphite.h>
+#include <pm/json.h>
+#include <pm/rate.h>
+
+#include <fstream>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+using namespace ::testing;
+using namespace pm;
+
+struct spool_test_t : public testing::Test {
+    spool_test_t() : registry(std::make_shared<tree_branch_t>()) {
+        char dir[] = "/tmp/pm_spool_XXXXXX";
+        EXPECT_TRUE(mkdtemp(dir));
+        path = std::string(dir) + "/spool";
+    }
+
+    ~spool_test_t() {
+        unlink(path.c_str());
+        for (int i = 1; i <= 3; ++i) {
+            unlink((path + "." + std::to_string(i)).c_str());
+        }
+        rmdir(path.substr(0, path.rfind('/')).c_str());
+    }
+
+    std::string replay() {
+        std::string result;
+
+        spool_reader_t reader(path);
+        while (reader.next()) {
+            graphite_printer_t p("g", reader.timestamp());
+            reader.print(&p);
+            result += p.result();
+        }
+
+        return result;
+    }
+
+    registry_t registry;
+    std::string path;
+};
+
+TEST_F(spool_test_t, empty) {
+    spool_writer_t writer(path, 1 << 20, 3);
+
+    ASSERT_EQ("", replay());
+}
+
+TEST_F(spool_test_t, replay) {
+    spool_writer_t writer(path, 1 << 20, 3);
+
+    counter_t a = registry.subtree("foo").counter("a");
+    counter_t b = registry.counter("b");
+
+    a.set(1);
+    b.set(-5);
+    writer.append(registry, 1000);
+
+    a.set(2);
+    writer.append(registry, 1001);
+
+    counter_t c = registry.subtree("foo").counter("c.d");
+    c.set(7);
+    writer.append(registry, 1003);
+
+    ASSERT_EQ(
+        "g.b -5 1000\n"
+        "g.foo.a 1 1000\n"
+        "g.b -5 1001\n"
+        "g.foo.a 2 1001\n"
+        "g.b -5 1003\n"
+        "g.foo.a 2 1003\n"
+        "g.foo.c_d 7 1003\n",
+        replay());
+}
+
+TEST_F(spool_test_t, values_are_compressed) {
+    spool_writer_t writer(path, 1 << 20, 3);
+
+    std::vector<counter_t> counters;
+    for (int i = 0; i < 100; ++i) {
+        counters.push_back(registry.counter("counter" + std::to_string(i)));
+    }
+
+    for (int t = 0; t < 100; ++t) {
+        writer.append(registry, 1000 + t);
+    }
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+    // names are written once, unchanged value takes two bytes
+    ASSERT_LT(file.tellg(), 100 * 100 * 2 + 2000);
+}
+
+TEST_F(spool_test_t, rotation) {
+    spool_writer_t writer(path, 256, 3);
+
+    counter_t a = registry.counter("a");
+    for (int t = 0; t < 1000; ++t) {
+        a.set(t);
+        writer.append(registry, t);
+    }
+
+    ASSERT_EQ(0, access((path + ".2").c_str(), F_OK));
+    ASSERT_NE(0, access((path + ".3").c_str(), F_OK));
+
+    spool_reader_t reader(path);
+    int64_t previous = -1, count = 0;
+    while (reader.next()) {
+        if (count) {
+            ASSERT_EQ(previous + 1, reader.timestamp());
+        }
+        previous = reader.timestamp();
+        ++count;
+    }
+
+    ASSERT_EQ(999, previous);
+    ASSERT_GT(count, 10);
+}
+
+TEST_F(spool_test_t, truncated_frame) {
+    {
+        spool_writer_t writer(path, 1 << 20, 3);
+
+        counter_t a = registry.counter("a");
+        a.set(1);
+        writer.append(registry, 1000);
+        a.set(2);
+        writer.append(registry, 1001);
+    }
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    ASSERT_EQ(0, truncate(path.c_str(), size_t(file.tellg()) - 1));
+
+    ASSERT_EQ("g.a 1 1000\n", replay());
+}
+
+TEST_F(spool_test_t, reopen_starts_new_file) {
+    counter_t a = registry.counter("a");
+
+    {
+        spool_writer_t writer(path, 1 << 20, 3);
+        a.set(1);
+        writer.append(registry, 1000);
+    }
+
+    {
+        spool_writer_t writer(path, 1 << 20, 3);
+        a.set(2);
+        writer.append(registry, 1001);
+    }
+
+    ASSERT_EQ(
+        "g.a 1 1000\n"
+        "g.a 2 1001\n",
+        replay());
+}
+
+TEST_F(spool_test_t, append_snapshot) {
+    spool_writer_t writer(path, 1 << 20, 3);
+
+    counter_t a = registry.counter("a");
+    a.set(3);
+
+    snapshot_t snapshot;
+    snapshot.capture(registry);
+    writer.append(snapshot, 1000);
+
+    ASSERT_EQ("g.a 3 1000\n", replay());
+}
+
+TEST_F(spool_test_t, monotonic_values) {
+    spool_writer_t writer(path, 1 << 20, 3);
+
+    // above 2^53, where doubles lose units
+    monotonic_counter_t bytes = registry.monotonic_counter("bytes");
+    bytes.inc((uint64_t(1) << 60) + 1);
+    writer.append(registry, 1000);
+    bytes.inc(3);
+    writer.append(registry, 1010);
+
+    spool_reader_t reader(path);
+    rate_printer_t rates;
+    json_printer_t p;
+    while (reader.next()) {
+        rates.reset(&p);
+        reader.print(&rates);
+    }
+
+    // doubles would round both totals to 2^60 and delta to 0, rate is over
+    // spooled timestamps
+    EXPECT_EQ(
+        "{\"bytes\":{\"total\":1152921504606846977,\"delta\":0,\"rate\":0}}\n"
+        "{\"bytes\":{\"total\":1152921504606846980,\"delta\":3,\"rate\":0.3}}\n",
+        p.result());
+}
@@ -0,0 +1,227 @@
+#include <pm/statsd.h>
+#include <pm/graphite.h>
+#include <pm/tree.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <system_error>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+using namespace ::testing;
+using namespace pm;
+
+static const std::string FLOAT_RE = "[0-9]+(.[0-9]+)?";
+
+struct statsd_test_t : public testing::Test {
+    statsd_test_t()
+        : registry(std::make_shared<tree_branch_t>()), server(registry) {}
+
+    std::string print() {
+        graphite_printer_t p("g", 100);
+        registry.print(&p);
+        return p.result();
+    }
+
+    void process(const std::string& packet) {
+        server.process(packet.data(), packet.size());
+    }
+
+    // packets are processed asynchronously
+    bool wait_lines(uint64_t n) {
+        for (int i = 0; i < 5000 && server.n_lines() < n; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return server.n_lines() == n;
+    }
+
+    registry_t registry;
+    statsd_server_t server;
+};
+
+TEST_F(statsd_test_t, counters_and_gauges) {
+    process("requests:1|c\nrequests:2|c|@0.5\n");
+    process("queue.size:10|g\nqueue.size:-3|g\r\nqueue.size:+1|g");
+
+    EXPECT_EQ(5u, server.n_lines());
+    EXPECT_EQ(0u, server.n_bad_lines());
+    EXPECT_EQ(
+        "g.queue.size 8 100\n"
+        "g.requests 5 100\n", print());
+}
+
+TEST_F(statsd_test_t, timers_histograms_meters) {
+    process("db.query:12.5|ms|#tag:value\nsize:300|h\nevents:3|m");
+
+    EXPECT_EQ(0u, server.n_bad_lines());
+    EXPECT_THAT(print(), MatchesRegex(
+        "g.db.query.active 0 100\n"
+        "g.db.query.rate.one_sec " + FLOAT_RE + " 100\n"
+        "g.db.query.rate.one_min " + FLOAT_RE + " 100\n"
+        "g.db.query.rate.quarter_hour " + FLOAT_RE + " 100\n"
+        "g.db.query.rate.one_hour " + FLOAT_RE + " 100\n"
+        "g.db.query.timings.q50 " + FLOAT_RE + " 100\n"
+        "g.db.query.timings.q80 " + FLOAT_RE + " 100\n"
+        "g.db.query.timings.q90 " + FLOAT_RE + " 100\n"
+        "g.db.query.timings.q95 " + FLOAT_RE + " 100\n"
+        "g.db.query.timings.q99 " + FLOAT_RE + " 100\n"
+        "g.db.query.timings.count 1 100\n"
+        "g.db.query.timings.sum 13 100\n"
+        "g.db.query.timings.min " + FLOAT_RE + " 100\n"
+        "g.db.query.timings.max " + FLOAT_RE + " 100\n"
+        "g.db.query.timings.mean " + FLOAT_RE + " 100\n"
+        "g.db.query.timings.stddev " + FLOAT_RE + " 100\n"
+        "g.db.query.timings.underflow 0 100\n"
+        "g.db.query.timings.overflow 0 100\n"
+        "g.events.one_sec " + FLOAT_RE + " 100\n"
+        "g.events.one_min " + FLOAT_RE + " 100\n"
+        "g.events.quarter_hour " + FLOAT_RE + " 100\n"
+        "g.events.one_hour " + FLOAT_RE + " 100\n"
+        "g.size.q50 " + FLOAT_RE + " 100\n"
+        "g.size.q80 " + FLOAT_RE + " 100\n"
+        "g.size.q90 " + FLOAT_RE + " 100\n"
+        "g.size.q95 " + FLOAT_RE + " 100\n"
+        "g.size.q99 " + FLOAT_RE + " 100\n"
+        "g.size.count 1 100\n"
+        "g.size.sum 300 100\n"
+        "g.size.min " + FLOAT_RE + " 100\n"
+        "g.size.max " + FLOAT_RE + " 100\n"
+        "g.size.mean " + FLOAT_RE + " 100\n"
+        "g.size.stddev " + FLOAT_RE + " 100\n"
+        "g.size.underflow 0 100\n"
+        "g.size.overflow 0 100\n"
+    ));
+
+    // meters are marked in bulk
+    EXPECT_THAT(print(), ContainsRegex("g.events.one_min 0.0(49|5)"));
+}
+
+TEST_F(statsd_test_t, histogram_range) {
+    process("auto:50000|h\nauto:3|h");
+
+    statsd_server_t fixed(registry);
+    fixed.set_histogram_range(0, 1000);
+    std::string packet = "fixed:50000|h\nfixed:-7|h";
+    fixed.process(packet.data(), packet.size());
+
+    std::string output = print();
+    EXPECT_THAT(output, ContainsRegex("g.auto.q99 5[0-9]{4} 100\n"));
+    EXPECT_THAT(output, HasSubstr("g.auto.underflow 0 100\n"));
+    EXPECT_THAT(output, HasSubstr("g.auto.overflow 0 100\n"));
+    EXPECT_THAT(output, HasSubstr("g.fixed.underflow 1 100\n"));
+    EXPECT_THAT(output, HasSubstr("g.fixed.overflow 1 100\n"));
+}
+
+TEST_F(statsd_test_t, bad_lines) {
+    process(
+        "\n"
+        "no_value\n"
+        ":1|c\n"
+        "name:1\n"
+        "name:x|c\n"
+        "name:1|z\n"
+        "name:1|c|@2\n"
+        "a..b:1|c\n"
+        "trailing.:1|c\n"
+        "name:1|c\n"
+        "name:1|ms\n");
+
+    EXPECT_EQ(10u, server.n_lines());
+    EXPECT_EQ(9u, server.n_bad_lines());
+    EXPECT_EQ("g.name 1 100\n", print());
+}
+
+TEST_F(statsd_test_t, max_metrics) {
+    statsd_server_t small(registry, 2);
+
+    std::string packet = "a:1|c\nb:1|c\nc:1|c\na:1|c";
+    small.process(packet.data(), packet.size());
+
+    EXPECT_EQ(1u, small.n_bad_lines());
+    EXPECT_EQ("g.a 2 100\ng.b 1 100\n", print());
+}
+
+TEST_F(statsd_test_t, udp) {
+    int port = server.listen_udp(0);
+    server.start();
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_GE(fd, 0);
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    std::string packet = "hits:1|c\nhits:1|c";
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(ssize_t(packet.size()),
+                  sendto(fd, packet.data(), packet.size(), 0,
+                         reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+    }
+    close(fd);
+
+    ASSERT_TRUE(wait_lines(200));
+    server.stop();
+
+    EXPECT_EQ("g.hits 200 100\n", print());
+}
+
+TEST_F(statsd_test_t, unix_socket) {
+    std::string path = "/tmp/pm_test_statsd." + std::to_string(getpid());
+    server.listen_unix(path);
+    server.start();
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    ASSERT_GE(fd, 0);
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+
+    std::string packet = "workers:4|g";
+    ASSERT_EQ(ssize_t(packet.size()),
+              sendto(fd, packet.data(), packet.size(), 0,
+                     reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+    close(fd);
+
+    ASSERT_TRUE(wait_lines(1));
+    EXPECT_EQ("g.workers 4 100\n", print());
+}
+
+TEST_F(statsd_test_t, unix_socket_path_is_checked) {
+    std::string path = "/tmp/pm_test_statsd_file." + std::to_string(getpid());
+    FILE* file = fopen(path.c_str(), "w");
+    ASSERT_TRUE(file);
+    fclose(file);
+
+    // regular file is not replaced
+    EXPECT_THROW(server.listen_unix(path), std::system_error);
+    EXPECT_EQ(0, access(path.c_str(), F_OK));
+    unlink(path.c_str());
+
+    // socket is replaced, but not removed if someone else took the path
+    {
+        statsd_server_t other(registry);
+        other.listen_unix(path);
+        other.listen_unix(path);
+
+        unlink(path.c_str());
+        file = fopen(path.c_str(), "w");
+        ASSERT_TRUE(file);
+        fclose(file);
+    }
+    EXPECT_EQ(0, access(path.c_str(), F_OK));
+    unlink(path.c_str());
+}
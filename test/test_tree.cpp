@@ -84,3 +84,59 @@ TEST_F(tree_test_t, remove_empty_nodes) {
     ASSERT_FALSE(live_branch2.expired());
     ASSERT_EQ(2, live_branch1.use_count());
 }
+
+TEST_F(tree_test_t, path_printer) {
+    path_printer_t paths(&graphite);
+
+    paths.leaf({"bar", "sub", "leaf1"});
+    graphite.value((int64_t)1);
+    paths.leaf({"bar", "leaf2"});
+    graphite.value((int64_t)2);
+    paths.leaf({"leaf3"});
+    graphite.value((int64_t)3);
+    paths.finish();
+
+    ASSERT_EQ(
+        "com.example.bar.sub.leaf1 1 15\n"
+        "com.example.bar.leaf2 2 15\n"
+        "com.example.leaf3 3 15\n",
+        graphite.result());
+}
+
+TEST_F(tree_test_t, print_removes_dead_nodes) {
+    // registration would remove them otherwise
+    auto leaf1 = make_leaf(1), leaf2 = make_leaf(2), leaf3 = make_leaf(3);
+    auto dead_branch = root.get_branch("dead_branch");
+
+    root.add_leaf("live", leaf1);
+    root.add_leaf("dead", leaf2);
+    dead_branch->get_branch("sub")->add_leaf("dead", leaf3);
+    auto live_branch = root.get_branch("live_branch");
+
+    leaf2.reset();
+    leaf3.reset();
+    dead_branch.reset();
+    ASSERT_EQ(6u, root.size());
+
+    root.print(&graphite);
+    ASSERT_EQ("com.example.live 1 15\n", graphite.result());
+    ASSERT_EQ(2u, root.size());
+}
+
+TEST_F(tree_test_t, registration_removes_dead_nodes) {
+    auto live = make_leaf(1);
+    root.get_branch("conns")->get_branch("live")->add_leaf("bytes", live);
+
+    // each connection leaves a dead subtree behind
+    for (int i = 0; i < 10000; ++i) {
+        auto conn = root.get_branch("conns")->get_branch(std::to_string(i));
+        conn->add_leaf("bytes", make_leaf(i));
+        conn->add_leaf("packets", make_leaf(i));
+    }
+
+    ASSERT_LT(root.size(), 100u);
+
+    root.print(&graphite);
+    ASSERT_EQ("com.example.conns.live.bytes 1 15\n", graphite.result());
+    ASSERT_EQ(3u, root.size());
+}